@@ -0,0 +1,77 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+
+#ifndef XSPRESS3BUFFERPOOL_H_
+#define XSPRESS3BUFFERPOOL_H_
+
+#include <stddef.h>
+#include <vector>
+#include "lima/Debug.h"
+#include "lima/ThreadUtils.h"
+#include "processlib/Data.h"
+
+namespace lima {
+namespace Xspress3 {
+
+/*******************************************************************
+ * \class BufferPool
+ * \brief pool of Processlib buffers for the data returned to clients
+ *
+ * Buffers are 64 byte aligned. Up to 4 MB they are rounded up to a
+ * power of two size class and kept for reuse when released, within a
+ * limit of 64 MB in all; larger buffers (e.g. whole histogram reads)
+ * are allocated to size and freed straight away. The pool is the
+ * callback of the Buffer so the memory comes back to the pool when
+ * the last reference is released, from any thread. The pool is never
+ * destroyed as clients may hold buffers after the camera is deleted.
+ *******************************************************************/
+class BufferPool : public Buffer::Callback {
+DEB_CLASS_NAMESPC(DebModCamera, "BufferPool", "Xspress3");
+
+public:
+	static BufferPool& getInstance();
+
+	Buffer* getBuffer(size_t size);
+	virtual void destroy(void* data);
+
+	void getStats(long long& hits, long long& misses);
+	void resetStats();
+	void clear();
+
+private:
+	enum {Alignment = 64, MinClassBits = 6, MaxClassBits = 22, NbClasses = MaxClassBits - MinClassBits + 1,
+		MaxFreePerClass = 16, MaxRetainedBytes = 64 << 20, Oversize = -1};
+
+	BufferPool();
+	virtual ~BufferPool();
+
+	std::vector<void*> m_free[NbClasses]; // free blocks per size class
+	size_t m_retained; // bytes of the free blocks
+	long long m_hits;
+	long long m_misses;
+	Mutex m_mutex;
+};
+
+} // namespace Xspress3
+} // namespace lima
+
+#endif /* XSPRESS3BUFFERPOOL_H_ */
@@ -36,6 +36,10 @@
 #include "lima/Debug.h"
 #include "processlib/Data.h"
 #include "xspress3.h"
+#include "Xspress3Dtc.h"
+#include "Xspress3FrameQueue.h"
+#include "Xspress3ReadPool.h"
+#include "Xspress3ThreadPlacement.h"
 #include "Xspress3Interface.h"
 
 using namespace std;
@@ -47,6 +51,7 @@ const int xPixelSize = 1;
 const int yPixelSize = 1;
 
 class BufferCtrlObj;
+class HdfWriter;
 
 /*******************************************************************
  * \class Camera
@@ -124,12 +129,35 @@ public:
 		Gap1us		///< 1us gap between frames. Allows long cables and  approx 70 cycle debounce time when using multiple boxes.
 	};
 
+	enum ResetLevel {
+		ResetSoft,	///< abort, stop the histogramming, clear the histogram memory state and re-arm
+		ResetSync,	///< as ResetSoft, then also rewrite the run flags and timing registers
+		ResetReconnect,	///< reopen the sdk path without initialising the hardware, re-apply the configuration set by this camera
+		ResetHard	///< full init(): reconnect, clocks, regions of interest and settings restore
+	};
+
+	enum InitState {
+		NotInitialised,	///< init() not started yet
+		Initialising,	///< init() in progress, in the background when the camera was created with asyncInit
+		Initialised,	///< the last init() completed
+		InitFailed		///< the last init() failed, reset() runs it again
+	};
+
+	enum ClearStrategy {
+		ClearSync,			///< prepareAcq() clears the frames of the acquisition
+		ClearAtPrepare,		///< prepareAcq() starts clearing in the background, startAcq() waits for the frames of the acquisition
+		ClearAfterReadout	///< the clear starts at the end of the acquisition, following the readout of the frames
+	};
+
 	Camera(int nbCards, int nbFrames, string baseIPaddress, int basePort, string baseMACaddress, int nbChans,
-		bool createScopeModule, string scopeModuleName, int debug, int cardIndex, bool noUDP, string directoryName);
+		bool createScopeModule, string scopeModuleName, int debug, int cardIndex, bool noUDP, string directoryName,
+		string threadPlacement="", bool asyncInit=false);
 	~Camera();
 
 	void init();
-	void reset();
+	void reset(ResetLevel level=ResetHard);
+	void getResetTime(double& reset_time);
+	void getReconnectStats(int& nb_writes, bool& clock_setup);
 	void prepareAcq();
 	void startAcq();
 	void stopAcq();
@@ -165,14 +193,19 @@ public:
 	void getNbFrames(int& nb_frames);
 
 	bool isAcqRunning() const;
+	void getPollPeriod(double& period);
+	void getNotifyLatency(double& latency);
 
 	///////////////////////////
 	// -- xspress3 specific functions
 	///////////////////////////
 
 	void setupClocks(ClockSrc clk_src, ClockFlags flags, int tp_type=0);
-	void setRunMode(bool playback=false, bool scope=false, bool scalers=true, bool hist=true);
+	void setRunMode(bool playback=false, bool scope=false, bool scalers=true, bool hist=true, bool circular=false);
 	void getRunMode(bool& playback, bool& scope, bool& scalers, bool& hist);
+	void getCircularBuffer(bool& circular);
+	void getCircOverrun(int chan, long long& num_overrun, long long& first_overrun);
+	void getExtFrameNumber(long long& frame_nb);
 	void getNbScalers(int& nscalers);
 	void getRevision(int& revision);
 	void initBrams(int chan);
@@ -182,6 +215,8 @@ public:
 	void setGoodThreshold(int chan, int good_thres);
 	void getGoodThreshold(int chan, u_int32_t& good_thres);
 	void saveSettings();
+	void getSaveSettingsStatus(bool& busy, string& error);
+	void getRestoreStatus(bool& from_snapshot, int& nb_writes, double& restore_time);
 	void restoreSettings(bool force_mismatch = false);
 	void setRinging(int chan, double scale_a, int delay_a, double scale_b, int delay_b);
 
@@ -202,6 +237,9 @@ public:
 	void start();
 	void stop();
 	void setClearMode(bool flag=true);
+	void setClearStrategy(ClearStrategy strategy);
+	void getClearStrategy(ClearStrategy& strategy);
+	void getClearStatus(int& dirty_frames, int& cleared_frames, double& wait_time);
 	void checkProgress(int& frameNos);
 	void setCard(int card);
 	void getCard(int& card);
@@ -214,8 +252,13 @@ public:
 	void setRoi(int chan, Xsp3Roi& roi, int& nbins);
 	void getUseDtc(bool &flag);
 	void setUseDtc(bool flag);
+	void getDtcFloat(bool &flag);
+	void setDtcFloat(bool flag);
+	void getDtcIsa(string& isa);
 	void readScalers(Data& temp, int frame_nb, int channel=-1);
 	void readHistogram(Data& temp, int frame_nb, int channel=-1);
+	void readScalerFrames(Data& scalerData, int first_frame, int nb_frames, long long chan_mask=-1);
+	void readHistogramFrames(Data& histData, int first_frame, int nb_frames, long long chan_mask=-1);
 	void readRawHistogram(Data& histData, int frame_nb, int channel);
 	void correctScalerData(double* buff, u_int32_t* fptr, int channe, double& dtcFactorl);
 	void setAdcTempLimit(int temp);
@@ -225,15 +268,91 @@ public:
 	void setTiming(int time_src, int fixed_time, int alt_ttl_mode, int debounce, bool loop_io=false,
 			bool f0_invert=false, bool veto_invert=false);
 	void setTimingMode();
+	void getTimingWrites(long long& nb_writes);
 	void formatRun(int chan, int nbits_eng=12, int aux1_mode=0, int adc_bits=0, int min_samples=0, int aux2_mode=0, bool pileup_reject=false);
 	void getDataSource(int chan, DataSrc& data_src);
 	void setDataSource(int chan, DataSrc data_src=Normal);
+	void setWindows(int win, Data& low, Data& high);
+	void getWindows(int win, Data& low, Data& high);
+	void setGoodThresholds(Data& good_thres);
+	void getGoodThresholds(Data& good_thres);
+	void setScalings(Data& scaling);
+	void setDataSources(Data& data_src);
+	void getDataSources(Data& data_src);
+	void setDeadtimeCorrectionParameterTable(Data& params);
+	void getDeadtimeCorrectionParameterTable(Data& params);
+	void setRois(Data& rois, Data& nbins);
 	void setItfgTiming(int nframes, int triggerMode, int gapMode);
+	void setReadBatchSize(int nb_frames);
+	void getReadBatchSize(int& nb_frames);
+	void setCardReadout(bool flag);
+	void getCardReadout(bool& flag);
+	void getCardProgress(Data& progress);
+	void setReadThreads(int nb_threads);
+	void getReadThreads(int& nb_threads);
+	void getReadPoolStats(long long& nb_tasks, long long& nb_stolen);
+	void getReadoutTime(int& nb_frames, double& read_time, double& publish_time);
+	void getStopLatency(double& stop_time, double& stop_latency);
+	void getInitState(InitState& state, string& progress, string& error);
+	void setInitTimeout(double timeout);
+	void getInitTimeout(double& timeout);
+	void getInitTime(double& connect, double& roi, double& clocks, double& restore, double& total);
+	void setThreadPlacement(string role, string cpus, int priority=0);
+	void getThreadPlacement(string role, string& cpus, int& priority, string& applied);
+	void setHdfFile(string filename);
+	void getHdfFile(string& filename);
+	void setHdfFramesPerWrite(int nb_frames);
+	void getHdfFramesPerWrite(int& nb_frames);
+	void getHdfStatus(int& nb_frames, double& frames_per_sec, string& error);
+	void getBufferPoolStats(long long& hits, long long& misses);
+	void resetBufferPoolStats();
+	void setRegisterCache(bool flag);
+	void getRegisterCache(bool& flag);
+	void invalidateRegisterCache();
+	void resyncRegisterCache();
+	void getRegisterCacheStats(long long& hits, long long& misses, long long& skipped_writes);
 	// internal only not for sip
 
 private:
 	class AcqThread;
 	class ReadThread;
+	class CardReadThread;
+	class ReadTask;
+	class ClearThread;
+	class SaveThread;
+	class InitThread;
+
+	enum InitPhase {InitRoi, InitClocks};
+
+	enum BulkParam {BulkWindow0, BulkWindow1, BulkGoodThres, BulkScaling, BulkDataSrc, BulkDtc, BulkRoi};
+
+	// channels of one card, resolved from the system channel numbers
+	struct CardInfo {
+		int card;
+		int path; // sdk path of the card
+		int chan_idx; // first channel on the card
+		int first_chan; // first system channel
+		int nb_chans;
+		vector<u_int32_t> hist_buffer; // per card batched reads, card read thread only
+		vector<u_int32_t> scaler_buffer;
+	};
+
+	// shadow of the channel registers, an entry is only used while its valid flag is set
+	struct ChanRegs {
+		ChanRegs() : good_thres_valid(false), chan_cont_valid(false), dtc_valid(false) {
+			window_valid[0] = window_valid[1] = false;
+		}
+		bool window_valid[2];
+		u_int32_t window_low[2];
+		u_int32_t window_high[2];
+		bool good_thres_valid;
+		u_int32_t good_thres;
+		bool chan_cont_valid;
+		u_int32_t chan_cont;
+		bool dtc_valid;
+		int dtc_flags;
+		double dtc_params[4];
+	};
 
 	// xspress3 specific
 	int m_nb_cards;
@@ -253,7 +372,24 @@ private:
 	string m_config_directory_name;
 	Status m_status;
 	bool m_use_dtc;
+	bool m_dtc_float; // dead time corrected histograms as float32
+	DtcKernel m_dtc_kernel;
+	vector<double> m_dtc_factors; // read thread frame correction
+	vector<double> m_dtc_all_event;
+	vector<int> m_dtc_flags;
+	HdfWriter* m_hdf_writer; // native HDF5 saving (WITH_HDF5_SAVING only)
+	string m_hdf_file;
 	bool m_clear_flag;
+	ClearStrategy m_clear_strategy;
+	vector<ClearThread*> m_clear_threads; // one per card
+	vector<int> m_cleared; // frames cleared per card by the current clear
+	int m_dirty_frames; // frames [0, m_dirty_frames) may hold data and are not being cleared
+	int m_clear_target; // the current clear is of frames [0, m_clear_target)
+	int m_clear_job; // incremented for each clear
+	bool m_clear_readout; // only clear the frames read, the readout of the last acquisition is in progress
+	string m_clear_error;
+	double m_clear_wait; // time startAcq() waited for the last clear (s)
+	Cond m_clear_cond;
 	int m_card;
 
 	// Lima
@@ -265,17 +401,141 @@ private:
 	int m_nb_frames; // nos of frames to acquire
 	bool m_thread_running;
 	bool m_wait_flag;
-	bool m_read_wait_flag;
-	bool m_quit;
-	bool m_abort;
-	int m_acq_frame_nb; // nos of frames acquired
-	int m_read_frame_nb; // nos of frames readout
+	volatile bool m_quit;
+	volatile bool m_abort;
+	volatile int m_acq_frame_nb; // nos of frames acquired, written by the acq thread only
+	volatile int m_read_frame_nb; // nos of frames readout, written by the read thread only
+	FrameQueue m_frame_queue; // completed frame ranges, acq thread -> read thread
+	volatile bool m_read_busy; // read thread has popped or may pop a range
+	volatile bool m_read_sleeping; // read thread is (about to be) waiting on m_read_cond
+	volatile bool m_acq_waiting; // acq thread is waiting on m_cond for the read thread to drain
+	Cond m_read_cond;
+	Timestamp m_acq_start;
+	double m_poll_period; // current progress poll period (s)
+	double m_notify_latency; // last frame notification latency (s)
+	Timestamp m_stop_request; // last stopAcq() while acquiring
+	double m_stop_time; // last histogram stop to idle (s)
+	double m_stop_latency; // last stopAcq() to Idle status (s)
+	int m_read_batch_size; // max nos of frames per hardware read
+	vector<u_int32_t> m_hist_buffer; // batched histogram read
+	vector<u_int32_t> m_scaler_buffer; // batched scaler read
+	bool m_circ_buffer; // continuous acquisition in circular buffer mode
+	long long m_ext_frame_nb; // extended frame number of the last frame read
+	vector<Xsp3TFStatus> m_tf_status;
+	vector<int64_t> m_circ_overruns; // overrun frames already reported per channel
+	bool m_card_readout; // one read thread per card
+	vector<CardInfo> m_cards;
+	vector<CardReadThread*> m_card_threads;
+	vector<void*> m_card_frame_ptrs; // Lima frames of the current card read
+	int m_card_job; // incremented for each frames read posted to the card threads
+	int m_card_first_frame;
+	int m_card_nb_frames;
+	int m_card_pending; // card threads still reading the current frames
+	string m_card_error;
+	Cond m_card_cond;
+	ThreadPlacement m_placement; // cpu sets and priorities of the thread roles
+	ReadPool m_read_pool; // per frame and channel readout when it has threads
+	ReadTask* m_read_task;
+	Mutex m_sdk_mutex; // sdk calls made from several threads at once (read pool)
+	int m_readout_frames; // frames read in the current acquisition, read thread only
+	double m_read_time; // time spent reading them from the hardware (s)
+	double m_publish_time; // time spent passing them to Lima (s)
+	bool m_reg_cache; // getters and setters go through the register shadow
+	vector<ChanRegs> m_chan_regs;
+	bool m_run_flags_valid;
+	int m_run_flags;
+	long long m_reg_hits; // reads served from the shadow
+	long long m_reg_misses; // reads from the hardware
+	long long m_reg_skipped; // writes of unchanged values
+	Mutex m_reg_mutex;
+	bool m_timing_valid; // the timing registers are programmed with the m_timing_* values
+	TrigMode m_timing_trig_mode;
+	double m_timing_exp_time;
+	int m_timing_nb_frames;
+	long long m_timing_writes; // timing register writes
+	double m_init_connect_time; // last init() phases (s)
+	double m_init_roi_time;
+	double m_init_clock_time;
+	double m_init_restore_time;
+	double m_init_total_time;
+	InitThread* m_init_thread; // background init() of the constructor (asyncInit)
+	volatile InitState m_init_state;
+	bool m_init_running; // init() is running on m_init_tid, whose hardware calls do not wait
+	pthread_t m_init_tid;
+	string m_init_progress; // current init() phase
+	string m_init_error;
+	double m_init_timeout; // max wait of a hardware call for the initialisation (s)
+	Cond m_init_cond;
+	SaveThread* m_save_thread; // background saveSettings()
+	int m_save_job; // incremented for each saveSettings()
+	int m_save_done; // last save job completed
+	string m_save_error;
+	Cond m_save_cond;
+	bool m_restore_snapshot; // last restoreSettings() used the snapshot
+	int m_restore_writes;
+	double m_restore_time; // last restoreSettings() (s)
+	double m_reset_time; // last reset() (s)
+	int m_reconnect_writes; // configuration writes of the last reconnect
+	bool m_reconnect_clocks; // the last reconnect had to set the clocks up
 	mutable Cond m_cond;
 
 	// Buffer control object
 	SoftBufferCtrlObj m_bufferCtrlObj;
 
 	void readFrame(void* ptr, int frame_nb);
+	void readFrames(int first_frame, int nb_frames);
+	void readFramesByCard(int first_frame, int nb_frames);
+	void readCardFrames(CardInfo& card, int first_frame, int nb_frames);
+	void readFramesByPool(int first_frame, int nb_frames);
+	void readChannel(void* fptr, int frame_nb, int chan, const u_int32_t* scalers);
+	void correctChannel(u_int32_t* bptr, double factor, double all_event, int flags);
+	void resolveCards();
+	void runInit(bool reconnect);
+	void initHardware();
+	void reconnectHardware();
+	bool checkClocks();
+	void setInitProgress(const char* progress);
+	void waitInit();
+	void waitInitDone();
+	void runPerCard(InitPhase phase, int first_card, int nb_cards);
+	void initCard(InitPhase phase, int card);
+	void waitSaveSettings();
+	void waitAcqIdle();
+	void softReset();
+	void writeSettings();
+	bool isSnapshotCurrent();
+	bool restoreSnapshot(bool force_mismatch);
+	void stopCardThreads();
+	void applySdkPlacement(ThreadPlacement::Role role);
+	void markDirty(int nb_frames);
+	void startClear(bool after_readout);
+	void waitCleared(int nb_frames);
+	int getClearedFrames();
+	void stopClearThreads();
+	ChanRegs* getChanRegs(int chan);
+	bool getCachedChans(int chan, int& first_chan, int& last_chan);
+	int getRunFlags();
+	void setRunFlags(int flags);
+	void getChanCont(int chan, u_int32_t& chan_control);
+	void getDtcParams(int chan, int& flags, double* params);
+	void getBulkValues(Data& data, int nb_values, const char* name, vector<double>& values);
+	void applyBulk(BulkParam param, const vector<double>& values, int nb_values, vector<int>& nbins);
+	void applyBulkChannel(BulkParam param, int chan, const double* v, int nb_values, int& nbins);
+	void correctFrame(void* fptr);
+	void saveFrames(int first_frame, int nb_frames);
+	void closeHdfFile();
+	void checkFrameRange(int first_frame, int nb_frames, long long chan_mask, vector<int>& chans);
+	void getScalerValues(double* dst, u_int32_t* sptr, double evtwidth, const double* dtc_factor,
+			const double* dtc_all_event, const int* dtc_flags);
+	Data::TYPE getHistType();
+	int getHistTypeSize(Data::TYPE type);
+	void getHistValues(void* dst, Data::TYPE type, u_int32_t* hptr, const double* dtc_factor);
+	void calcDtcFactors(u_int32_t* scalers, int stride, int first_chan, int nb_chans, double* factors, double* all_event, int* flags);
+	void ackFrames(int first_frame, int nb_frames);
+	bool isItfgTimed() const;
+	void commitTiming();
+	void wakeReadThread();
+	void notifyReadIdle();
 };
 
 inline std::ostream& operator<<(std::ostream& os, const Camera::Xsp3Roi& roi)
@@ -0,0 +1,69 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+
+#ifndef XSPRESS3DTC_H_
+#define XSPRESS3DTC_H_
+
+#include <sys/types.h>
+
+namespace lima {
+namespace Xspress3 {
+
+/*******************************************************************
+ * \class DtcKernel
+ * \brief dead time correction of all the channels of a frame
+ *
+ * The histograms are read from a Lima frame (one row of npixels
+ * histogram bins followed by the scalers per channel) and written
+ * contiguously, channel after channel, to the destination.
+ * The instruction set is selected at run time (AVX2, SSE2 or scalar).
+ * For one channel the destination may be the source (in place).
+ *******************************************************************/
+class DtcKernel {
+public:
+	enum Isa {Scalar, Sse2, Avx2};
+
+	DtcKernel();
+
+	Isa getIsa() const {return m_isa;}
+	void setIsa(Isa isa);
+	static Isa getBestIsa();
+	static const char* getIsaName(Isa isa);
+
+	void correctHistograms(const u_int32_t* src, int src_stride, int nb_chans, int npixels,
+			const double* factors, double* dst) const;
+	void correctHistograms(const u_int32_t* src, int src_stride, int nb_chans, int npixels,
+			const double* factors, float* dst) const;
+
+	static void correctScalers(const u_int32_t* src, int src_stride, int nb_chans, int nscalers,
+			const double* factors, const double* all_event, const int* flags, double* dst);
+	static void correctScalers(const u_int32_t* src, int src_stride, int nb_chans, int nscalers,
+			const double* factors, const double* all_event, const int* flags, float* dst);
+
+private:
+	Isa m_isa;
+};
+
+} // namespace Xspress3
+} // namespace lima
+
+#endif /* XSPRESS3DTC_H_ */
@@ -0,0 +1,87 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+
+#ifndef XSPRESS3FRAMEQUEUE_H_
+#define XSPRESS3FRAMEQUEUE_H_
+
+#include <vector>
+
+namespace lima {
+namespace Xspress3 {
+
+/*******************************************************************
+ * \class FrameQueue
+ * \brief Bounded lock-free queue of completed frame ranges
+ *
+ * Single producer (the acquisition thread) and single consumer (the
+ * read thread) only. Each index is written by one side and read by
+ * the other, the barriers order the range contents with the index
+ * update so neither side needs a lock.
+ *******************************************************************/
+class FrameQueue {
+public:
+	struct Range {
+		int first_frame;
+		int nb_frames;
+	};
+
+	FrameQueue(int size = DefSize) : m_ranges(size), m_head(0), m_tail(0) {}
+
+	/** Producer only, false if the queue is full */
+	bool push(int first_frame, int nb_frames) {
+		int head = m_head;
+		int next = (head + 1) % (int)m_ranges.size();
+		if (next == m_tail)
+			return false;
+		m_ranges[head].first_frame = first_frame;
+		m_ranges[head].nb_frames = nb_frames;
+		__sync_synchronize();
+		m_head = next;
+		return true;
+	}
+
+	/** Consumer only, false if the queue is empty */
+	bool pop(Range& range) {
+		int tail = m_tail;
+		if (tail == m_head)
+			return false;
+		__sync_synchronize();
+		range = m_ranges[tail];
+		__sync_synchronize();
+		m_tail = (tail + 1) % (int)m_ranges.size();
+		return true;
+	}
+
+	bool empty() const {return m_head == m_tail;}
+
+private:
+	enum {DefSize = 256};
+
+	std::vector<Range> m_ranges;
+	volatile int m_head; // written by the producer
+	volatile int m_tail; // written by the consumer
+};
+
+} // namespace Xspress3
+} // namespace lima
+
+#endif /* XSPRESS3FRAMEQUEUE_H_ */
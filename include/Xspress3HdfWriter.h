@@ -0,0 +1,131 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+
+#ifndef XSPRESS3HDFWRITER_H_
+#define XSPRESS3HDFWRITER_H_
+
+#include <sys/types.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include "H5Cpp.h"
+#include "lima/Debug.h"
+#include "lima/ThreadUtils.h"
+#include "lima/Timestamp.h"
+#include "Xspress3Dtc.h"
+#include "Xspress3ThreadPlacement.h"
+
+namespace lima {
+namespace Xspress3 {
+
+/*******************************************************************
+ * \class HdfWriter
+ * \brief NeXus/HDF5 file of histograms, scalers and dead time corrected data
+ *
+ * File layout:
+ * @verbatim
+ * /Entry/start_time, end_time
+ * /Entry/Instrument/Xspress3/firmware-version, dtc-correction-energy
+ * /Entry/Instrument/Xspress3/channel_NN/histogram        [frames][bins] uint32
+ * /Entry/Instrument/Xspress3/channel_NN/histogram-dtc    [frames][bins] float
+ * /Entry/Instrument/Xspress3/channel_NN/scaler           [frames][scalers] uint32
+ * /Entry/Instrument/Xspress3/channel_NN/scaler-dtc       [frames][scalers] float
+ * /Entry/Instrument/Xspress3/channel_NN/dtc-correction-parameters/...
+ * /Entry/Data/channel_NN -> histogram-dtc (or histogram)
+ * @endverbatim
+ * Frames are copied into blocks of frames_per_write frames which a
+ * dedicated thread writes, one hyperslab per dataset per block, into
+ * datasets chunked by the same number of whole frames.
+ *******************************************************************/
+class HdfWriter {
+DEB_CLASS_NAMESPC(DebModCamera, "HdfWriter", "Xspress3");
+
+public:
+	HdfWriter(ThreadPlacement* placement = NULL);
+	~HdfWriter();
+
+	void open(const std::string& filename, int nb_chans, int npixels, int nscalers, bool raw_frames, bool dtc,
+			const std::string& firmware, double dtc_energy, const std::vector<double>& dtc_params);
+	void addFrame(const u_int32_t* frame, const double* factors, const double* all_event, const int* flags);
+	void close();
+	bool isOpen();
+
+	void setFramesPerWrite(int nb_frames);
+	int getFramesPerWrite() const {return m_frames_per_write;}
+	void getStatus(int& nb_frames, double& frames_per_sec, std::string& error);
+
+private:
+	class WriteThread;
+	struct Block {
+		int first_frame;
+		int nb_frames;
+		std::vector<u_int32_t> frames;
+		std::vector<double> factors;
+		std::vector<double> all_event;
+		std::vector<int> flags;
+	};
+
+	void writeBlock(Block& block);
+	void writeSlab(H5::DataSet& dataset, int first_frame, int nb_frames, int width, const void* buff,
+			const H5::PredType& type);
+	H5::DataSet createDataSet(H5::Group& group, const std::string& name, const H5::PredType& type, int width);
+	void writeString(H5::Group& group, const std::string& name, const std::string& value);
+	void clearBlocks();
+
+	int m_frames_per_write;
+	int m_nb_chans;
+	int m_npixels;
+	int m_nscalers;
+	bool m_raw_frames; // Bpp32 frames, otherwise Bpp32F dead time corrected by the read thread
+	bool m_dtc;
+	bool m_open;
+	bool m_writing;
+	bool m_quit;
+	int m_nb_added;
+	int m_nb_written;
+	Timestamp m_open_time;
+	Timestamp m_write_time;
+	std::string m_error;
+
+	H5::H5File m_file;
+	H5::Group m_entry;
+	std::vector<H5::DataSet> m_histogram;
+	std::vector<H5::DataSet> m_histogram_dtc;
+	std::vector<H5::DataSet> m_scaler;
+	std::vector<H5::DataSet> m_scaler_dtc;
+
+	Block* m_cur_block;
+	std::deque<Block*> m_full_blocks;
+	std::vector<Block*> m_free_blocks;
+	std::vector<u_int32_t> m_buff; // per channel gather, used by write thread only
+	std::vector<float> m_fbuff;
+	DtcKernel m_dtc_kernel;
+
+	ThreadPlacement* m_placement; // Writer role, optional
+	WriteThread* m_write_thread;
+	Cond m_cond;
+};
+
+} // namespace Xspress3
+} // namespace lima
+
+#endif /* XSPRESS3HDFWRITER_H_ */
@@ -0,0 +1,93 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+
+#ifndef XSPRESS3READPOOL_H_
+#define XSPRESS3READPOOL_H_
+
+#include <string>
+#include <vector>
+#include <deque>
+#include "lima/Debug.h"
+#include "lima/ThreadUtils.h"
+#include "Xspress3ThreadPlacement.h"
+
+namespace lima {
+namespace Xspress3 {
+
+/*******************************************************************
+ * \class ReadPool
+ * \brief work stealing pool of threads for per channel frame tasks
+ *
+ * run() splits a block of frames x channels into one task per frame
+ * and channel. Each worker starts with a contiguous share of the
+ * tasks, taken from the front of its own queue, and once it is empty
+ * steals from the back of the other queues, so a slow channel or
+ * worker does not hold back the block. run() returns when every task
+ * has completed, the caller then publishes the frames in order.
+ *******************************************************************/
+class ReadPool {
+DEB_CLASS_NAMESPC(DebModCamera, "ReadPool", "Xspress3");
+
+public:
+	class Task {
+	public:
+		virtual ~Task() {}
+		virtual void run(int frame, int chan) = 0;
+	};
+
+	ReadPool();
+	~ReadPool();
+
+	void setPlacement(ThreadPlacement* placement) {m_placement = placement;}
+	void setNbThreads(int nb_threads);
+	int getNbThreads() const {return m_threads.size();}
+	void run(Task& task, int nb_frames, int nb_chans);
+	void getStats(long long& nb_tasks, long long& nb_stolen);
+
+private:
+	class WorkerThread;
+	struct Queue {
+		std::deque<int> tasks; // frame * nb_chans + chan
+		Mutex mutex;
+	};
+
+	bool popTask(int worker, int& task);
+	bool stealTask(int worker, int& task);
+	void stopThreads();
+
+	std::vector<WorkerThread*> m_threads;
+	std::vector<Queue*> m_queues; // one per worker
+	ThreadPlacement* m_placement; // Read role, optional
+	Task* m_task;
+	int m_nb_chans;
+	int m_job; // incremented for each run()
+	int m_pending; // workers still busy on the current run()
+	std::string m_error;
+	long long m_nb_tasks;
+	long long m_nb_stolen;
+	Cond m_cond;
+};
+
+} // namespace Xspress3
+} // namespace lima
+
+#endif /* XSPRESS3READPOOL_H_ */
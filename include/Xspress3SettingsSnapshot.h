@@ -0,0 +1,85 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+
+#ifndef XSPRESS3SETTINGSSNAPSHOT_H_
+#define XSPRESS3SETTINGSSNAPSHOT_H_
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include "lima/Debug.h"
+
+namespace lima {
+namespace Xspress3 {
+
+/*******************************************************************
+ * \class SettingsSnapshot
+ * \brief binary image of the xspress3 settings with a content hash
+ *
+ * Holds the global registers of each card (except the clock, MDIO,
+ * timing and ITFG registers, which init() and prepareAcq() program), the
+ * registers and BRAMs of each channel, and the sdk dead time
+ * correction parameters. read() takes them from the hardware,
+ * save() and load() keep them in a file, restore() writes to the
+ * hardware only the words that differ from a snapshot just read.
+ *******************************************************************/
+class SettingsSnapshot {
+DEB_CLASS_NAMESPC(DebModCamera, "SettingsSnapshot", "Xspress3");
+
+public:
+	SettingsSnapshot();
+
+	void read(int handle, int nb_cards, int nb_chans);
+	void save(const std::string& filename) const;
+	void load(const std::string& filename);
+	int restore(int handle, const SettingsSnapshot& current) const;
+
+	bool empty() const {return m_blocks.empty();}
+	int getRevision() const {return m_revision;}
+	unsigned long long getHash() const {return m_hash;}
+
+private:
+	enum Kind {GlobRegs, ChanRegs};
+	struct Block {
+		int kind;
+		int index; // card for GlobRegs, system channel for ChanRegs
+		int region; // XSP3_REGION_REGS or a BRAM region
+		std::vector<u_int32_t> words;
+	};
+
+	void updateHash();
+	int writeBlock(int handle, const Block& block, const Block& current) const;
+
+	int m_revision;
+	int m_nb_cards;
+	int m_nb_chans;
+	std::vector<Block> m_blocks;
+	std::vector<int> m_dtc_flags; // per channel
+	std::vector<double> m_dtc_params; // 4 per channel
+	double m_dtc_energy;
+	unsigned long long m_hash;
+};
+
+} // namespace Xspress3
+} // namespace lima
+
+#endif /* XSPRESS3SETTINGSSNAPSHOT_H_ */
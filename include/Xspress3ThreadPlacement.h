@@ -0,0 +1,85 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+
+#ifndef XSPRESS3THREADPLACEMENT_H_
+#define XSPRESS3THREADPLACEMENT_H_
+
+#include <sched.h>
+#include <string>
+#include "lima/Debug.h"
+#include "lima/ThreadUtils.h"
+
+namespace lima {
+namespace Xspress3 {
+
+/*******************************************************************
+ * \class ThreadPlacement
+ * \brief CPU set and SCHED_FIFO priority of each thread role
+ *
+ * The plugin threads place themselves: each one calls update() with
+ * its role when it wakes up, which only makes system calls when the
+ * placement of the role has changed since its last call, then
+ * records the placement read back from the system. The sdk receive
+ * and scope threads are placed by the camera with the sdk cpu set
+ * calls, the sdk has no priority control.
+ *
+ * A policy is a semicolon separated list of role=cpus[:priority], e.g.
+ * "hist=0-7;read=8-11:50;writer=12", cpus as for taskset -c.
+ *******************************************************************/
+class ThreadPlacement {
+DEB_CLASS_NAMESPC(DebModCamera, "ThreadPlacement", "Xspress3");
+
+public:
+	enum Role {Hist, Scope, Acq, Read, Writer, NbRoles};
+
+	ThreadPlacement();
+
+	void set(Role role, const std::string& cpus, int priority);
+	void get(Role role, std::string& cpus, int& priority);
+	bool getCpuSet(Role role, cpu_set_t& cpu_set);
+	void setPolicy(const std::string& policy);
+	void update(Role role, int& generation);
+	void setApplied(Role role, const std::string& applied);
+	void getApplied(Role role, std::string& applied);
+
+	static Role getRole(const std::string& name);
+	static const char* getRoleName(Role role);
+	static void parseCpus(const std::string& cpus, cpu_set_t& cpu_set);
+	static std::string formatCpus(const cpu_set_t& cpu_set);
+
+private:
+	struct Entry {
+		std::string cpus;
+		cpu_set_t cpu_set;
+		int priority; // SCHED_FIFO priority, 0 for SCHED_OTHER
+		std::string applied;
+	};
+
+	Entry m_roles[NbRoles];
+	volatile int m_generation[NbRoles];
+	Mutex m_mutex;
+};
+
+} // namespace Xspress3
+} // namespace lima
+
+#endif /* XSPRESS3THREADPLACEMENT_H_ */
@@ -0,0 +1,141 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+
+#include <stdlib.h>
+#include "lima/Exceptions.h"
+#include "Xspress3BufferPool.h"
+
+using namespace lima;
+using namespace lima::Xspress3;
+
+// each block starts with one alignment unit holding its size class (Oversize for the blocks not pooled), the data follows
+struct BlockHeader {
+    int size_class;
+};
+
+BufferPool::BufferPool() : m_retained(0), m_hits(0), m_misses(0) {
+    DEB_CONSTRUCTOR();
+}
+
+BufferPool::~BufferPool() {
+    DEB_DESTRUCTOR();
+    clear();
+}
+
+BufferPool& BufferPool::getInstance() {
+    static BufferPool* pool = new BufferPool();
+    return *pool;
+}
+
+/**
+ * Get a buffer of at least size bytes, 64 byte aligned, with a reference count of 1.
+ *
+ * @param[in] size the number of bytes
+ * @return the buffer, its memory goes back to the pool when it is unreferenced
+ */
+Buffer* BufferPool::getBuffer(size_t size) {
+    DEB_MEMBER_FUNCT();
+    int size_class = 0;
+    while (size_class < NbClasses && ((size_t)1 << (size_class + MinClassBits)) < size) {
+        size_class++;
+    }
+    size_t class_size;
+    if (size_class == NbClasses) {
+        size_class = Oversize;
+        class_size = (size + Alignment - 1) / Alignment * Alignment;
+    } else {
+        class_size = (size_t)1 << (size_class + MinClassBits);
+    }
+
+    void* block = NULL;
+    {
+        AutoMutex aLock(m_mutex);
+        if (size_class != Oversize && !m_free[size_class].empty()) {
+            block = m_free[size_class].back();
+            m_free[size_class].pop_back();
+            m_retained -= class_size;
+            ++m_hits;
+        } else {
+            ++m_misses;
+        }
+    }
+    if (block == NULL) {
+        if (posix_memalign(&block, Alignment, Alignment + class_size) != 0) {
+            THROW_HW_ERROR(Error) << "Cannot allocate buffer " << DEB_VAR1(class_size);
+        }
+        ((BlockHeader*)block)->size_class = size_class;
+    }
+    Buffer* buffer = new Buffer();
+    buffer->data = (char*)block + Alignment;
+    buffer->callback = this;
+    return buffer;
+}
+
+/**
+ * Called by Processlib when the last reference to a pool buffer is released.
+ */
+void BufferPool::destroy(void* data) {
+    void* block = (char*)data - Alignment;
+    int size_class = ((BlockHeader*)block)->size_class;
+    if (size_class == Oversize) {
+        free(block);
+        return;
+    }
+    size_t class_size = (size_t)1 << (size_class + MinClassBits);
+    AutoMutex aLock(m_mutex);
+    if ((int)m_free[size_class].size() < MaxFreePerClass && m_retained + class_size <= MaxRetainedBytes) {
+        m_free[size_class].push_back(block);
+        m_retained += class_size;
+    } else {
+        aLock.unlock();
+        free(block);
+    }
+}
+
+/**
+ * Get the number of buffers served from the pool and the number newly allocated.
+ */
+void BufferPool::getStats(long long& hits, long long& misses) {
+    AutoMutex aLock(m_mutex);
+    hits = m_hits;
+    misses = m_misses;
+}
+
+void BufferPool::resetStats() {
+    AutoMutex aLock(m_mutex);
+    m_hits = 0;
+    m_misses = 0;
+}
+
+/**
+ * Release the memory of the free buffers.
+ */
+void BufferPool::clear() {
+    AutoMutex aLock(m_mutex);
+    for (int i = 0; i < NbClasses; i++) {
+        for (size_t j = 0; j < m_free[i].size(); j++) {
+            free(m_free[i][j]);
+        }
+        m_free[i].clear();
+    }
+    m_retained = 0;
+}
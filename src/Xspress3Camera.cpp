@@ -24,11 +24,36 @@
 #include "lima/Exceptions.h"
 #include "lima/Debug.h"
 #include "Xspress3Interface.h"
+#include "Xspress3BufferPool.h"
+#include "Xspress3SettingsSnapshot.h"
+#ifdef WITH_HDF5_SAVING
+#include "Xspress3HdfWriter.h"
+#endif
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <dirent.h>
+#include <sys/stat.h>
 
 using namespace lima;
 using namespace lima::Xspress3;
 using namespace std;
 
+// bounds of the adaptive progress poll period (seconds)
+static const double MinPollPeriod = 200E-6;
+static const double MaxPollPeriod = 0.5;
+// bounds of the histogram busy poll period after a stop, and how long to wait for idle (seconds)
+static const double MaxStopPollPeriod = 0.01;
+static const double StopTimeout = 5.0;
+// default maximum number of frames per batched read
+static const int DefReadBatchSize = 32;
+// number of frames per histogram clear call of the background clear
+static const int ClearChunkFrames = 256;
+// default time a hardware call waits for a background initialisation (seconds)
+static const double DefInitTimeout = 30.0;
+
+static const char* SnapshotFileName = "lima_settings.snap";
+
 //---------------------------
 //- utility thread
 //---------------------------
@@ -43,6 +68,9 @@ protected:
 
 private:
     Camera& m_cam;
+    int m_placement_gen;
+    int waitForFrames(int nb_frames);
+    void publishFrames(int& published_frame_nb);
 };
 
 class Camera::ReadThread: public Thread {
@@ -56,96 +84,718 @@ protected:
 
 private:
     Camera& m_cam;
+    int m_placement_gen;
+};
+
+class Camera::CardReadThread: public Thread {
+DEB_CLASS_NAMESPC(DebModCamera, "Camera", "CardReadThread");
+public:
+    CardReadThread(Camera &aCam, int card_nb);
+    virtual ~CardReadThread();
+
+protected:
+    virtual void threadFunction();
+
+private:
+    Camera& m_cam;
+    int m_card_nb; // index in Camera::m_cards
+    int m_job; // last frames read done
+    int m_placement_gen;
+    bool m_quit;
+};
+
+class Camera::ClearThread: public Thread {
+DEB_CLASS_NAMESPC(DebModCamera, "Camera", "ClearThread");
+public:
+    ClearThread(Camera &aCam, int card_nb, int first_chan, int nb_chans);
+    virtual ~ClearThread();
+
+protected:
+    virtual void threadFunction();
+
+private:
+    Camera& m_cam;
+    int m_card_nb; // index in Camera::m_cleared
+    int m_first_chan;
+    int m_nb_chans;
+    int m_job; // last clear done
+    int m_placement_gen;
+    bool m_quit;
+};
+
+class Camera::SaveThread: public Thread {
+DEB_CLASS_NAMESPC(DebModCamera, "Camera", "SaveThread");
+public:
+    SaveThread(Camera &aCam);
+    virtual ~SaveThread();
+
+protected:
+    virtual void threadFunction();
+
+private:
+    Camera& m_cam;
+    int m_placement_gen;
+    bool m_quit;
+};
+
+class Camera::InitThread: public Thread {
+DEB_CLASS_NAMESPC(DebModCamera, "Camera", "InitThread");
+public:
+    InitThread(Camera &aCam);
+    virtual ~InitThread();
+
+protected:
+    virtual void threadFunction();
+
+private:
+    Camera& m_cam;
+};
+
+class Camera::ReadTask: public ReadPool::Task {
+public:
+    ReadTask(Camera& aCam) : m_cam(aCam), m_first_frame(0) {}
+    void setFrames(int first_frame, int nb_frames);
+    void calcDtcFactors();
+    virtual void run(int frame, int chan);
+
+private:
+    Camera& m_cam;
+    int m_first_frame;
+    vector<void*> m_frame_ptrs;
+    vector<double> m_factors; // Bpp32F: per frame and channel of the block
+    vector<double> m_all_event;
+    vector<int> m_flags;
 };
 
+
 //---------------------------
 // @brief  Ctor
 //---------------------------
 
 Camera::Camera(int nbCards, int maxFrames, string baseIPaddress, int basePort, string baseMACaddress, int nbChans,
-        bool createScopeModule, string scopeModuleName, int debug, int cardIndex, bool noUDP, string directoryName) : m_nb_cards(nbCards), m_max_frames(maxFrames),
+        bool createScopeModule, string scopeModuleName, int debug, int cardIndex, bool noUDP, string directoryName,
+        string threadPlacement, bool asyncInit) : m_nb_cards(nbCards), m_max_frames(maxFrames),
         m_baseIPaddress(baseIPaddress), m_basePort(basePort), m_baseMACaddress(baseMACaddress), m_nb_chans(nbChans),
         m_create_module(createScopeModule), m_modname(scopeModuleName), m_card_index(cardIndex), m_debug(debug), m_npixels(4096), m_nscalers(XSP3_SW_NUM_SCALERS),
-        m_no_udp(noUDP), m_config_directory_name(directoryName), m_trigger_mode(IntTrig), m_image_type(Bpp32), m_nb_frames(1), m_acq_frame_nb(-1),
+        m_handle(-1), m_no_udp(noUDP), m_config_directory_name(directoryName), m_trigger_mode(IntTrig), m_image_type(Bpp32), m_nb_frames(1), m_acq_frame_nb(-1),
         m_bufferCtrlObj() {
 
     DEB_CONSTRUCTOR();
     m_card = -1;
+    m_status = Idle;
     m_use_dtc = false;
+    m_dtc_float = false;
+    m_hdf_writer = NULL;
+    m_placement.setPolicy(threadPlacement);
+    m_read_pool.setPlacement(&m_placement);
     m_acq_thread = new AcqThread(*this);
     m_acq_thread->start();
     m_read_thread = new ReadThread(*this);
     m_read_thread->start();
     m_clear_flag = true;
+    m_clear_strategy = ClearSync;
+    m_dirty_frames = maxFrames; // unknown until the first clear
+    m_clear_target = 0;
+    m_clear_job = 0;
+    m_clear_readout = false;
+    m_clear_wait = 0.0;
     m_exp_time = 0.0;
-    init();
+    m_poll_period = MaxPollPeriod;
+    m_notify_latency = 0.0;
+    m_stop_time = 0.0;
+    m_stop_latency = 0.0;
+    m_read_batch_size = DefReadBatchSize;
+    m_card_readout = false;
+    m_card_job = 0;
+    m_card_first_frame = 0;
+    m_card_nb_frames = 0;
+    m_card_pending = 0;
+    m_read_task = new ReadTask(*this);
+    m_readout_frames = 0;
+    m_read_time = 0.0;
+    m_publish_time = 0.0;
+    m_circ_buffer = false;
+    m_ext_frame_nb = -1;
+    m_reg_cache = true;
+    m_run_flags_valid = false;
+    m_run_flags = 0;
+    m_reg_hits = 0;
+    m_reg_misses = 0;
+    m_reg_skipped = 0;
+    m_timing_valid = false;
+    m_timing_trig_mode = m_trigger_mode;
+    m_timing_exp_time = 0.0;
+    m_timing_nb_frames = 0;
+    m_timing_writes = 0;
+    m_init_connect_time = 0.0;
+    m_init_roi_time = 0.0;
+    m_init_clock_time = 0.0;
+    m_init_restore_time = 0.0;
+    m_init_total_time = 0.0;
+    m_save_job = 0;
+    m_save_done = 0;
+    m_restore_snapshot = false;
+    m_restore_writes = 0;
+    m_restore_time = 0.0;
+    m_reset_time = 0.0;
+    m_reconnect_writes = 0;
+    m_reconnect_clocks = false;
+    m_save_thread = new SaveThread(*this);
+    m_save_thread->start();
+    m_init_thread = NULL;
+    m_init_state = NotInitialised;
+    m_init_running = false;
+    m_init_timeout = DefInitTimeout;
+    if (asyncInit) {
+        // the hardware calls wait for it, see waitInit()
+        m_init_state = Initialising;
+        m_init_progress = "starting";
+        m_init_thread = new InitThread(*this);
+        m_init_thread->start();
+    } else {
+        init();
+    }
 }
 
 Camera::~Camera() {
     DEB_DESTRUCTOR();
+    waitInitDone();
+    delete m_init_thread;
     delete m_acq_thread;
     delete m_read_thread;
-    if (xsp3_close(m_handle) < 0){
-        THROW_HW_ERROR(Error) << xsp3_get_error_message();
+    waitSaveSettings();
+    delete m_save_thread;
+    stopCardThreads();
+    stopClearThreads();
+    m_read_pool.setNbThreads(0);
+    delete m_read_task;
+#ifdef WITH_HDF5_SAVING
+    delete m_hdf_writer;
+#endif
+    if (m_handle >= 0 && xsp3_close(m_handle) < 0){
+        DEB_ERROR() << "Closing the connection: " << xsp3_get_error_message();
     }
 }
 
+/**
+ * Connect to the boxes and set them up. The hardware calls of other threads wait for it to complete, see
+ * getInitState().
+ */
 void Camera::init() {
     DEB_MEMBER_FUNCT();
+    runInit(false);
+}
+
+/**
+ * Run initHardware() or reconnectHardware(), the hardware calls of other threads wait for it.
+ */
+void Camera::runInit(bool reconnect) {
+    DEB_MEMBER_FUNCT();
+    AutoMutex aLock(m_init_cond.mutex());
+    m_init_tid = pthread_self();
+    m_init_running = true;
+    m_init_state = Initialising;
+    m_init_error.clear();
+    aLock.unlock();
+    string error;
+    try {
+        if (reconnect) {
+            reconnectHardware();
+        } else {
+            initHardware();
+        }
+    } catch (Exception& e) {
+        error = e.getErrMsg();
+    }
+    aLock.lock();
+    m_init_running = false;
+    m_init_state = error.empty() ? Initialised : InitFailed;
+    m_init_error = error;
+    m_init_progress = error.empty() ? "done" : "failed";
+    m_init_cond.broadcast();
+    aLock.unlock();
+    if (!error.empty()) {
+        THROW_HW_ERROR(Error) << (reconnect ? "Reconnect failed: " : "Initialisation failed: ") << error;
+    }
+}
+
+void Camera::initHardware() {
+    DEB_MEMBER_FUNCT();
+    Timestamp t0 = Timestamp::now();
     if (m_no_udp) {
         m_baseMACaddress = "00:00:00:00:00:00";
     }
     DEB_TRACE() << "Connecting to the Xspress3...";
+    setInitProgress("connecting");
+    if (m_handle >= 0 && xsp3_close(m_handle) < 0) {
+        DEB_WARNING() << "Closing the previous connection: " << xsp3_get_error_message();
+    }
+    m_handle = -1;
     if ((m_handle = xsp3_config(m_nb_cards, m_max_frames, (char*)m_baseIPaddress.c_str(), m_basePort, (char*)m_baseMACaddress.c_str(), m_nb_chans,
             m_create_module, (char*)m_modname.c_str(), m_debug, m_card_index)) < 0) {
         THROW_HW_ERROR(Error) << xsp3_get_error_message();
     }
+    invalidateRegisterCache();
+    m_timing_valid = false;
+    applySdkPlacement(ThreadPlacement::Hist);
+    applySdkPlacement(ThreadPlacement::Scope);
+    resolveCards();
+    Timestamp t1 = Timestamp::now();
+    m_init_connect_time = t1 - t0;
+
     DEB_TRACE() << "Initialise the ROI's";
-    initRoi(-1);
+    setInitProgress("regions of interest");
+    runPerCard(InitRoi, 0, m_cards.size());
+    Timestamp t2 = Timestamp::now();
+    m_init_roi_time = t2 - t1;
 
     DEB_TRACE() << "Set up clock register to use ADC clock...";
-
-    setCard(0);
-    int gen = xsp3_get_generation(m_handle, m_card);
-    for (int i=0; i<m_nb_cards; i++) {
-        setCard(i);
-        setupClocks(gen == 3 ? (m_nb_cards > 1 ? Camera::X4MplLMK : Camera::X4AdcLMK): 
-            (gen == 2 ? Camera::Mini : Camera::XtalClk), 
-        Camera::Master | Camera::NoDither, 0);
-    }
+    setInitProgress("clocks");
+    // the first card drives the clock of the others, it is set up before them
+    runPerCard(InitClocks, 0, m_nb_cards);
     setCard(-1);
+    Timestamp t3 = Timestamp::now();
+    m_init_clock_time = t3 - t2;
+
     if (m_config_directory_name != "") {
+        setInitProgress("settings restore");
         restoreSettings();
     }
+    Timestamp t4 = Timestamp::now();
+    m_init_restore_time = t4 - t3;
 
     DEB_TRACE() <<  "Set up default run flags...";
+    setInitProgress("run flags");
     setRunMode();
+    AutoMutex aLock(m_cond.mutex());
     m_status = Idle;
+    aLock.unlock();
+    m_init_total_time = Timestamp::now() - t0;
     DEB_TRACE() << "Use dtc " << m_use_dtc;
-    DEB_TRACE() << "Initialisation complete";
+    DEB_TRACE() << "Initialisation complete " << DEB_VAR5(m_init_connect_time, m_init_roi_time, m_init_clock_time,
+            m_init_restore_time, m_init_total_time);
 }
 
-void Camera::reset() {
+/**
+ * Run an initialisation phase on consecutive cards. The sdk is not documented as thread safe on a shared path and
+ * its error message is global, so the cards are done one after the other: the time of the sdk calls is spent in the
+ * calls themselves, there is no waiting left to overlap.
+ *
+ * @param[in] phase the initialisation phase
+ * @param[in] first_card the first card
+ * @param[in] nb_cards the number of cards
+ */
+void Camera::runPerCard(InitPhase phase, int first_card, int nb_cards) {
     DEB_MEMBER_FUNCT();
-    init();
+    for (int card = first_card; card < first_card + nb_cards; card++) {
+        initCard(phase, card);
+    }
 }
 
-void Camera::prepareAcq() {
+/**
+ * Initialisation phase of one card (InitRoi: index in m_cards, InitClocks: card number).
+ */
+void Camera::initCard(InitPhase phase, int card) {
+    DEB_MEMBER_FUNCT();
+    switch (phase) {
+        case InitRoi: {
+            CardInfo& info = m_cards[card];
+            for (int chan = info.first_chan; chan < info.first_chan + info.nb_chans; chan++) {
+                if (xsp3_init_roi(m_handle, chan) < 0) {
+                    THROW_HW_ERROR(Error) << "channel " << chan << ": " << xsp3_get_error_message();
+                }
+            }
+            break;
+        }
+        case InitClocks: {
+            int gen = xsp3_get_generation(m_handle, 0);
+            ClockSrc clk_src = gen == 3 ? (m_nb_cards > 1 ? Camera::X4MplLMK : Camera::X4AdcLMK) :
+                    (gen == 2 ? Camera::Mini : Camera::XtalClk);
+            DEB_TRACE() << "Clock setup " << DEB_VAR2(card, clk_src);
+            if (xsp3_clocks_setup(m_handle, card, clk_src, Camera::Master | Camera::NoDither, 0) < 0) {
+                THROW_HW_ERROR(Error) << "card " << card << ": " << xsp3_get_error_message();
+            }
+            break;
+        }
+    }
+}
+
+/**
+ * Reopen the sdk path without initialising the hardware, after a network glitch. The boxes keep their registers, the
+ * sdk side state (dead time correction) and the registers known to the shadow are written again. The clocks are only
+ * set up if they are no longer running from the ADC board.
+ */
+void Camera::reconnectHardware() {
     DEB_MEMBER_FUNCT();
-    if (m_clear_flag) {
-        DEB_TRACE() << "Clear memory " << DEB_VAR2(m_nb_chans, m_nb_frames);
-        if (xsp3_histogram_clear(m_handle, 0, m_nb_chans, 0, m_nb_frames) < 0) {
+    // held by the sdk in memory, taken before the path is closed
+    vector<int> dtc_flags(m_nb_chans);
+    vector<double> dtc_params(m_nb_chans * 4);
+    for (int chan = 0; chan < m_nb_chans; chan++) {
+        double* p = &dtc_params[chan * 4];
+        if (xsp3_getDeadtimeCorrectionParameters(m_handle, chan, &dtc_flags[chan], &p[0], &p[1], &p[2], &p[3]) < 0) {
+            THROW_HW_ERROR(Error) << "channel " << chan << ": " << xsp3_get_error_message();
+        }
+    }
+    double energy = xsp3_getDeadtimeCalculationEnergy(m_handle);
+
+    DEB_TRACE() << "Reconnecting to the Xspress3...";
+    setInitProgress("reconnecting");
+    if (xsp3_close(m_handle) < 0) {
+        DEB_WARNING() << "Closing the connection: " << xsp3_get_error_message();
+    }
+    m_handle = -1;
+    if ((m_handle = xsp3_config_init(m_nb_cards, m_max_frames, (char*)m_baseIPaddress.c_str(), m_basePort,
+            (char*)m_baseMACaddress.c_str(), m_nb_chans, m_create_module, (char*)m_modname.c_str(), m_debug, m_card_index, 0)) < 0) {
+        THROW_HW_ERROR(Error) << xsp3_get_error_message();
+    }
+    applySdkPlacement(ThreadPlacement::Hist);
+    applySdkPlacement(ThreadPlacement::Scope);
+    resolveCards();
+
+    setInitProgress("clocks");
+    m_reconnect_clocks = !checkClocks();
+    if (m_reconnect_clocks) {
+        DEB_WARNING() << "Clocks lost, setting them up";
+        runPerCard(InitClocks, 0, 1);
+        runPerCard(InitClocks, 1, m_nb_cards - 1);
+        setCard(-1);
+    }
+
+    setInitProgress("configuration");
+    int nb_writes = 0;
+    for (int chan = 0; chan < m_nb_chans; chan++) {
+        double* p = &dtc_params[chan * 4];
+        if (xsp3_setDeadtimeCorrectionParameters(m_handle, chan, dtc_flags[chan], p[0], p[1], p[2], p[3]) < 0) {
+            THROW_HW_ERROR(Error) << "channel " << chan << ": " << xsp3_get_error_message();
+        }
+        nb_writes++;
+    }
+    if (energy >= 0.0) {
+        if (xsp3_setDeadtimeCalculationEnergy(m_handle, energy) < 0) {
             THROW_HW_ERROR(Error) << xsp3_get_error_message();
         }
+        nb_writes++;
+    }
+    AutoMutex aLock(m_reg_mutex);
+    for (int chan = 0; chan < (int)m_chan_regs.size(); chan++) {
+        ChanRegs& regs = m_chan_regs[chan];
+        int status = 0;
+        for (int win = 0; win < 2; win++) {
+            if (regs.window_valid[win]) {
+                status |= xsp3_set_window(m_handle, chan, win, regs.window_low[win], regs.window_high[win]);
+                nb_writes++;
+            }
+        }
+        if (regs.good_thres_valid) {
+            status |= xsp3_set_good_thres(m_handle, chan, regs.good_thres);
+            nb_writes++;
+        }
+        if (regs.chan_cont_valid) {
+            status |= xsp3_set_chan_cont(m_handle, chan, regs.chan_cont);
+            nb_writes++;
+        }
+        if (status < 0) {
+            m_chan_regs[chan] = ChanRegs();
+            THROW_HW_ERROR(Error) << "channel " << chan << ": " << xsp3_get_error_message();
+        }
+    }
+    int status = xsp3_set_run_flags(m_handle, m_run_flags);
+    m_run_flags_valid = m_reg_cache && status >= 0;
+    if (status < 0) {
+        THROW_HW_ERROR(Error) << xsp3_get_error_message();
+    }
+    nb_writes++;
+    aLock.unlock();
+    // rewritten by the next prepareAcq()
+    m_timing_valid = false;
+    m_reconnect_writes = nb_writes;
+    softReset();
+    DEB_TRACE() << "Reconnect complete " << DEB_VAR2(m_reconnect_clocks, m_reconnect_writes);
+}
+
+/**
+ * Check that the clocks of every card are still set up: running from the ADC board (xspress3) and with a clock period.
+ */
+bool Camera::checkClocks() {
+    DEB_MEMBER_FUNCT();
+    for (int card = 0; card < m_nb_cards; card++) {
+        if (xsp3_get_clock_period(m_handle, card) <= 0.0) {
+            return false;
+        }
+        if (xsp3_get_generation(m_handle, card) < XspressGen3Mini) {
+            u_int32_t clock;
+            if (xsp3_get_clock_control(m_handle, card, &clock) < 0 || !(clock & XSP3_GLOB_CLK_FROM_ADC)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Get the outcome of the last ResetReconnect.
+ *
+ * @param[out] nb_writes the number of configuration writes
+ * @param[out] clock_setup true if the clocks had to be set up again
+ */
+void Camera::getReconnectStats(int& nb_writes, bool& clock_setup) {
+    DEB_MEMBER_FUNCT();
+    nb_writes = m_reconnect_writes;
+    clock_setup = m_reconnect_clocks;
+}
+
+/**
+ * Get the time spent in each phase of the last init().
+ *
+ * @param[out] connect connection to the boxes (s)
+ * @param[out] roi regions of interest initialisation (s)
+ * @param[out] clocks clock setup (s)
+ * @param[out] restore settings restore (s)
+ * @param[out] total the whole init() (s)
+ */
+void Camera::getInitTime(double& connect, double& roi, double& clocks, double& restore, double& total) {
+    DEB_MEMBER_FUNCT();
+    connect = m_init_connect_time;
+    roi = m_init_roi_time;
+    clocks = m_init_clock_time;
+    restore = m_init_restore_time;
+    total = m_init_total_time;
+}
+
+/**
+ * Get the initialisation state.
+ *
+ * @param[out] state NotInitialised, Initialising, Initialised or InitFailed
+ * @param[out] progress the current or last phase of init()
+ * @param[out] error the error of a failed init()
+ */
+void Camera::getInitState(InitState& state, string& progress, string& error) {
+    DEB_MEMBER_FUNCT();
+    AutoMutex aLock(m_init_cond.mutex());
+    state = m_init_state;
+    progress = m_init_progress;
+    error = m_init_error;
+}
+
+/**
+ * Set how long a hardware call waits for an initialisation in progress before failing.
+ *
+ * @param[in] timeout the timeout (s)
+ */
+void Camera::setInitTimeout(double timeout) {
+    DEB_MEMBER_FUNCT();
+    DEB_PARAM() << DEB_VAR1(timeout);
+    if (timeout < 0) {
+        THROW_HW_ERROR(InvalidValue) << "Invalid init timeout " << timeout;
+    }
+    AutoMutex aLock(m_init_cond.mutex());
+    m_init_timeout = timeout;
+}
+
+void Camera::getInitTimeout(double& timeout) {
+    DEB_MEMBER_FUNCT();
+    AutoMutex aLock(m_init_cond.mutex());
+    timeout = m_init_timeout;
+}
+
+void Camera::setInitProgress(const char* progress) {
+    AutoMutex aLock(m_init_cond.mutex());
+    m_init_progress = progress;
+}
+
+/**
+ * Called by the hardware calls: wait up to the init timeout for an initialisation in progress, fail if it does
+ * not complete or has failed. The thread running init() goes straight through.
+ */
+void Camera::waitInit() {
+    DEB_MEMBER_FUNCT();
+    if (m_init_state == Initialised)
+        return;
+    AutoMutex aLock(m_init_cond.mutex());
+    if (m_init_running && pthread_equal(m_init_tid, pthread_self()))
+        return;
+    Timestamp start = Timestamp::now();
+    while (m_init_state == Initialising) {
+        double left = m_init_timeout - (Timestamp::now() - start);
+        if (left <= 0) {
+            THROW_HW_ERROR(Error) << "Initialisation still in progress (" << m_init_progress << ")";
+        }
+        m_init_cond.wait(left);
+    }
+    if (m_init_state == InitFailed) {
+        THROW_HW_ERROR(Error) << "Initialisation failed: " << m_init_error;
+    }
+    if (m_init_state == NotInitialised) {
+        THROW_HW_ERROR(Error) << "Not initialised";
+    }
+}
+
+/**
+ * Wait, without timeout, for an initialisation in progress on another thread to complete or fail.
+ */
+void Camera::waitInitDone() {
+    DEB_MEMBER_FUNCT();
+    AutoMutex aLock(m_init_cond.mutex());
+    while (m_init_state == Initialising && !(m_init_running && pthread_equal(m_init_tid, pthread_self()))) {
+        m_init_cond.wait();
+    }
+}
+
+/**
+ * Reset the camera.
+ *
+ * @param[in] level ResetSoft: abort any acquisition, stop the histogramming, mark the whole histogram memory for
+ *            clearing and re-arm, without touching the configuration.
+ *            ResetSync: as ResetSoft, then also reload the register shadow and rewrite the run flags and timing
+ *            registers.
+ *            ResetReconnect: abort any acquisition, reopen the sdk path without initialising the hardware and write
+ *            again the configuration this camera set, falling back to init() if it fails.
+ *            ResetHard: abort any acquisition then re-run init(), reconnecting and setting up every card.
+ */
+void Camera::reset(ResetLevel level) {
+    DEB_MEMBER_FUNCT();
+    DEB_PARAM() << DEB_VAR1(level);
+    Timestamp start = Timestamp::now();
+    waitInitDone();
+    if (level != ResetHard && m_init_state != Initialised) {
+        DEB_WARNING() << "Not initialised, reset escalated to ResetHard";
+        level = ResetHard;
+    }
+    stopAcq();
+    waitAcqIdle();
+    if (level == ResetReconnect) {
+        try {
+            runInit(true);
+        } catch (Exception& e) {
+            DEB_WARNING() << e.getErrMsg() << ", full init";
+            init();
+        }
+    } else if (level == ResetHard) {
+        init();
+    } else {
+        softReset();
+        if (level == ResetSync) {
+            invalidateRegisterCache();
+            AutoMutex aLock(m_reg_mutex);
+            int flags = m_run_flags;
+            aLock.unlock();
+            setRunFlags(flags);
+            // only the timing prepareAcq() programmed, anything else is an error there
+            if (m_timing_valid) {
+                setTimingMode();
+            }
+        }
+    }
+    m_reset_time = Timestamp::now() - start;
+    DEB_TRACE() << DEB_VAR2(level, m_reset_time);
+}
+
+/**
+ * Get the time of the last reset (s).
+ */
+void Camera::getResetTime(double& reset_time) {
+    DEB_MEMBER_FUNCT();
+    reset_time = m_reset_time;
+}
+
+/**
+ * Wait for the acquisition thread to go idle after stopAcq(), a thread stuck in an sdk call is reported and left.
+ */
+void Camera::waitAcqIdle() {
+    DEB_MEMBER_FUNCT();
+    AutoMutex aLock(m_cond.mutex());
+    Timestamp start = Timestamp::now();
+    while (m_thread_running) {
+        if (Timestamp::now() - start > StopTimeout * 2) {
+            DEB_WARNING() << "Acquisition thread still running " << StopTimeout * 2 << " s after stop";
+            break;
+        }
+        m_cond.wait(MaxStopPollPeriod);
     }
 }
 
+void Camera::softReset() {
+    DEB_MEMBER_FUNCT();
+    stop();
+    m_acq_frame_nb = -1;
+    m_read_frame_nb = 0;
+    m_ext_frame_nb = -1;
+    m_circ_overruns.assign(m_nb_chans, 0);
+    // the next prepareAcq() clears the frames it needs
+    markDirty(m_max_frames);
+    arm();
+    AutoMutex aLock(m_cond.mutex());
+    m_status = Idle;
+}
+
+void Camera::prepareAcq() {
+    DEB_MEMBER_FUNCT();
+    waitInit();
+    if (!m_circ_buffer && (m_nb_frames == 0 || m_nb_frames > m_max_frames)) {
+        THROW_HW_ERROR(Error) << "Number of frames " << m_nb_frames << " exceeds the histogram memory of "
+                              << m_max_frames << " frames, use the circular buffer run mode";
+    }
+    commitTiming();
+    m_ext_frame_nb = -1;
+    m_circ_overruns.assign(m_nb_chans, 0);
+    // in circular buffer mode the receive threads clear each frame before histogramming into it
+    if (m_clear_flag && !m_circ_buffer) {
+        if (m_clear_strategy != ClearSync) {
+            // startAcq() waits for the frames of the acquisition
+            startClear(false);
+        } else {
+            // after a change of strategy, let a background clear complete first
+            waitCleared(INT_MAX);
+            AutoMutex aLock(m_clear_cond.mutex());
+            int nb_frames = min(m_nb_frames, m_dirty_frames);
+            aLock.unlock();
+            DEB_TRACE() << "Clear memory " << DEB_VAR2(m_nb_chans, nb_frames);
+            if (nb_frames > 0 && xsp3_histogram_clear(m_handle, 0, m_nb_chans, 0, nb_frames) < 0) {
+                THROW_HW_ERROR(Error) << xsp3_get_error_message();
+            }
+            aLock.lock();
+            if (m_dirty_frames <= m_nb_frames) {
+                m_dirty_frames = 0;
+            }
+        }
+    }
+#ifdef WITH_HDF5_SAVING
+    if (!m_hdf_file.empty()) {
+        vector<double> dtc_params(m_nb_chans * 4);
+        for (int chan = 0; chan < m_nb_chans; chan++) {
+            int flags;
+            getDtcParams(chan, flags, &dtc_params[chan * 4]);
+        }
+        string firmware;
+        getDetectorModel(firmware);
+        if (m_hdf_writer == NULL) {
+            m_hdf_writer = new HdfWriter(&m_placement);
+        }
+        m_hdf_writer->open(m_hdf_file, m_nb_chans, m_npixels, m_nscalers, m_image_type == Bpp32, m_use_dtc, firmware,
+                xsp3_getDeadtimeCalculationEnergy(m_handle), dtc_params);
+    }
+#endif
+}
+
 void Camera::startAcq() {
     DEB_MEMBER_FUNCT();
+    waitInit();
+    if (m_trigger_mode == IntTrigMult && isAcqRunning()) {
+        // next frame of the sequence, the ITFG waits for a rising edge on count enable
+        pause();
+        restart();
+        AutoMutex aLock(m_cond.mutex());
+        m_status = Running;
+        return;
+    }
+    if (m_clear_flag && !m_circ_buffer && m_clear_strategy != ClearSync) {
+        waitCleared(m_nb_frames);
+    }
     m_acq_frame_nb = 0; // Number of frames of data acquired;
     m_read_frame_nb = 0; // Number of frames read into Lima buffers
     StdBufferCbMgr& buffer_mgr = m_bufferCtrlObj.getBuffer();
-    buffer_mgr.setStartTimestamp(Timestamp::now());
+    m_acq_start = Timestamp::now();
+    buffer_mgr.setStartTimestamp(m_acq_start);
     if (xsp3_histogram_start(m_handle, m_card) < 0) {
         THROW_HW_ERROR(Error) << xsp3_get_error_message();
     }
@@ -162,8 +812,13 @@ void Camera::startAcq() {
 void Camera::stopAcq() {
     DEB_MEMBER_FUNCT();
     AutoMutex aLock(m_cond.mutex());
+    if (!m_abort) {
+        m_stop_request = Timestamp::now();
+    }
     m_wait_flag = true;
     m_abort = true;
+    // wakes the acq thread straight away, whether it is polling the progress or waiting for the read thread
+    m_cond.broadcast();
 }
 
 void Camera::getStatus(Status& status) {
@@ -179,6 +834,7 @@ int Camera::getNbHwAcquiredFrames() {
 
 void Camera::AcqThread::threadFunction() {
     DEB_MEMBER_FUNCT();
+    m_cam.m_placement.update(ThreadPlacement::Acq, m_placement_gen);
     AutoMutex aLock(m_cam.m_cond.mutex());
 
     while (!m_cam.m_quit) {
@@ -196,206 +852,362 @@ void Camera::AcqThread::threadFunction() {
             return;
         }
         aLock.unlock();
+        m_cam.m_placement.update(ThreadPlacement::Acq, m_placement_gen);
 
-        bool continueFlag = true;
-        while (continueFlag && (!m_cam.m_nb_frames || m_cam.m_acq_frame_nb < m_cam.m_nb_frames)) {
+        // Frames are timed by the hardware (ITFG, external trigger or gate), only track their completion
+        int published_frame_nb = 0;
+        while (!m_cam.m_nb_frames || m_cam.m_acq_frame_nb < m_cam.m_nb_frames) {
             DEB_TRACE() << DEB_VAR1(m_cam.m_trigger_mode);
-            if (m_cam.m_trigger_mode == IntTrig) {
-          
-                struct timespec delay, remain;
-                delay.tv_sec = (int)floor(m_cam.m_exp_time);
-                delay.tv_nsec = (int)(1E9*(m_cam.m_exp_time-floor(m_cam.m_exp_time)));
-                DEB_TRACE() << "acq thread will sleep for " << m_cam.m_exp_time << " second";
-                while (nanosleep(&delay, &remain) == -1 && errno == EINTR) {
-                    // stop called ?
-                    //AutoMutex aLock(m_cam.m_cond.mutex());
-                    //continueFlag = !m_cam.m_wait_flag;
-                  //if (m_cam.m_wait_flag) {
-                  //    DEB_TRACE() << "acq thread histogram stopped  by user";
-                  //    m_cam.stop();
-                  //break;
-                  //}
-                    delay = remain;
-                }
-                if (m_cam.m_abort) {
-                     DEB_TRACE() << "acq thread histogram stopped  by user";
-                     m_cam.stop();
-                     break;
-                } else if (m_cam.m_acq_frame_nb < m_cam.m_nb_frames-1) {
-                    m_cam.pause();
-                    m_cam.restart();
-                    DEB_TRACE() << "acq thread histogram paused and restarted " << m_cam.m_wait_flag;
-                } else {
-                    DEB_TRACE() << "acq thread histogram stop";
-                    m_cam.stop();
-                }
-                aLock.lock();
-                ++m_cam.m_acq_frame_nb;
-              
-                delay.tv_sec = 0;
-                delay.tv_nsec = (int)(1E9*0.5);
-                int completed_frames;
-                do {
-                    m_cam.checkProgress(completed_frames);
-                    DEB_TRACE() << DEB_VAR2(completed_frames, m_cam.m_acq_frame_nb);
-                        nanosleep(&delay, &remain);
-                } while (completed_frames < m_cam.m_acq_frame_nb);
-                m_cam.m_read_wait_flag = false;
-                DEB_TRACE() << "acq thread signal read thread: " << m_cam.m_acq_frame_nb << " frames collected";
-                m_cam.m_cond.broadcast();
-                aLock.unlock();
-
-            } else {
-                struct timespec delay, remain;
-                delay.tv_sec = 0;
-                delay.tv_nsec = (int)(1E9*0.5);
-                DEB_TRACE() << "Started checking in while loop";
-
-                int completed_frames;
-                do {
-                     m_cam.checkProgress(completed_frames);
-                     DEB_TRACE() << completed_frames << " " << m_cam.m_acq_frame_nb;
-                     DEB_TRACE() << "acq thread will sleep for " << delay.tv_nsec << " nanosecond";
-                     nanosleep(&delay, &remain);
-                     if (m_cam.m_abort) {
-                       DEB_TRACE() << "acq thread histogram stopped  by user";
-                       m_cam.stop();
-                       break;
-                     }
-                } while (completed_frames <= m_cam.m_acq_frame_nb);
+            int completed_frames = waitForFrames(m_cam.m_acq_frame_nb + 1);
+            DEB_TRACE() << DEB_VAR2(completed_frames, m_cam.m_acq_frame_nb);
+            if (m_cam.m_abort) {
+                DEB_TRACE() << "acq thread histogram stopped  by user";
+                m_cam.stop();
+                break;
+            }
+            m_cam.m_acq_frame_nb = (m_cam.m_nb_frames && completed_frames > m_cam.m_nb_frames) ? m_cam.m_nb_frames : completed_frames;
+            if (m_cam.m_trigger_mode == IntTrigMult && m_cam.m_acq_frame_nb < m_cam.m_nb_frames) {
+                // the ITFG is now paused until the next startAcq()
                 aLock.lock();
-                m_cam.m_acq_frame_nb = (completed_frames > m_cam.m_nb_frames) ? m_cam.m_nb_frames : completed_frames;
-                m_cam.m_read_wait_flag = false;
-                DEB_TRACE() << "acq thread signal read thread: " << m_cam.m_acq_frame_nb << " frames collected";
-                m_cam.m_cond.broadcast();
+                m_cam.m_status = Paused;
                 aLock.unlock();
-
             }
-
-            if (m_cam.m_abort) 
-                break;
-
-
+            publishFrames(published_frame_nb);
+        }
+        if (!m_cam.m_abort && m_cam.isItfgTimed()) {
+            DEB_TRACE() << "acq thread histogram stop";
+            m_cam.stop();
+        }
+        if (!m_cam.m_circ_buffer) {
+            // including the frame in progress when aborted
+            m_cam.markDirty(m_cam.m_acq_frame_nb + 1);
+            if (m_cam.m_clear_flag && m_cam.m_clear_strategy == ClearAfterReadout) {
+                m_cam.startClear(true);
+            }
         }
 
-        //      if (!m_cam.m_wait_flag) { // user requested stop
-        if (!m_cam.m_abort) { // user requested stop
-            // wait for read thread to finish here
-            DEB_TRACE() << "acq thread Wait for read thead to finish";
-            aLock.lock();
+        aLock.lock();
+        // wait for read thread to finish here, after an abort only until it has dropped the queued frames
+        DEB_TRACE() << "acq thread Wait for read thead to finish";
+        m_cam.m_acq_waiting = true;
+        __sync_synchronize();
+        while (!m_cam.m_quit && (m_cam.m_read_busy || !m_cam.m_frame_queue.empty() ||
+                (!m_cam.m_abort && m_cam.m_read_frame_nb < m_cam.m_acq_frame_nb))) {
             m_cam.m_cond.wait();
         }
+        m_cam.m_acq_waiting = false;
+        aLock.unlock();
+        m_cam.closeHdfFile();
+        aLock.lock();
 
+        if (m_cam.m_clear_readout) {
+            // the frames not read will not be, let the clear complete
+            AutoMutex clearLock(m_cam.m_clear_cond.mutex());
+            m_cam.m_clear_readout = false;
+            m_cam.m_clear_cond.broadcast();
+        }
+        if (m_cam.m_abort) {
+            m_cam.m_stop_latency = Timestamp::now() - m_cam.m_stop_request;
+            DEB_TRACE() << "stop to idle " << DEB_VAR2(m_cam.m_stop_latency, m_cam.m_stop_time);
+        }
         m_cam.m_status = Idle;
         m_cam.m_thread_running = false;
         m_cam.m_wait_flag = true;
+        m_cam.m_cond.broadcast();
         DEB_TRACE() << "acq thread finished acquire " << m_cam.m_acq_frame_nb << " frames, required " << m_cam.m_nb_frames << " frames";
     }
 }
 
-Camera::AcqThread::AcqThread(Camera& cam) : m_cam(cam) {
-    AutoMutex aLock(m_cam.m_cond.mutex());
-    m_cam.m_wait_flag = true;
-    m_cam.m_quit = false;
-    aLock.unlock();
-    pthread_attr_setscope(&m_thread_attr, PTHREAD_SCOPE_PROCESS);
+/**
+ * Hand the frames completed since the last call to the read thread. Only blocks if the read
+ * thread has fallen so far behind that the frame queue is full.
+ *
+ * @param[in,out] published_frame_nb the number of frames already handed to the read thread
+ */
+void Camera::AcqThread::publishFrames(int& published_frame_nb) {
+    DEB_MEMBER_FUNCT();
+    int acq_frame_nb = m_cam.m_acq_frame_nb;
+    if (acq_frame_nb <= published_frame_nb) {
+        return;
+    }
+    while (!m_cam.m_frame_queue.push(published_frame_nb, acq_frame_nb - published_frame_nb)) {
+        DEB_TRACE() << "frame queue full, wait for read thread";
+        AutoMutex aLock(m_cam.m_cond.mutex());
+        if (m_cam.m_abort || m_cam.m_quit) {
+            return;
+        }
+        m_cam.m_cond.wait(MinPollPeriod);
+    }
+    DEB_TRACE() << "acq thread signal read thread: " << acq_frame_nb << " frames collected";
+    published_frame_nb = acq_frame_nb;
+    m_cam.wakeReadThread();
 }
 
-Camera::AcqThread::~AcqThread() {
-    AutoMutex aLock(m_cam.m_cond.mutex());
-    m_cam.m_quit = true;
+/**
+ * Poll the scaler progress until at least nb_frames have completed or the acquisition is aborted.
+ * The poll period follows the expected frame period (exposure time, or the measured frame rate once
+ * frames have arrived) and backs off exponentially while no frames arrive. The wait is done on the
+ * camera condition so that stopAcq() wakes the thread immediately.
+ *
+ * @param[in] nb_frames the number of completed frames to wait for
+ * @return the number of frames completed by the hardware
+ */
+int Camera::AcqThread::waitForFrames(int nb_frames) {
+    DEB_MEMBER_FUNCT();
+    int completed_frames;
+    Timestamp wait_start = Timestamp::now();
+
+    AutoMutex aLock(m_cam.m_cond.mutex());
+    double frame_period = m_cam.m_exp_time;
+    if (m_cam.m_acq_frame_nb > 0) {
+        frame_period = (wait_start - m_cam.m_acq_start) / m_cam.m_acq_frame_nb;
+    }
+    double period = min(max(frame_period / 2, MinPollPeriod), MaxPollPeriod);
+    Timestamp last_poll = wait_start;
+
+    while (true) {
+        aLock.unlock();
+        m_cam.checkProgress(completed_frames);
+        Timestamp now = Timestamp::now();
+        aLock.lock();
+        if (completed_frames >= nb_frames) {
+            m_cam.m_notify_latency = now - last_poll;
+            break;
+        }
+        if (m_cam.m_abort || m_cam.m_quit) {
+            break;
+        }
+        // back off once the frame is overdue, the gate or trigger may be idle
+        if (now - wait_start > frame_period) {
+            period = min(period * 2, MaxPollPeriod);
+        }
+        m_cam.m_poll_period = period;
+        last_poll = now;
+        m_cam.m_cond.wait(period);
+    }
+    DEB_TRACE() << DEB_VAR3(completed_frames, m_cam.m_poll_period, m_cam.m_notify_latency);
+    return completed_frames;
+}
+
+Camera::AcqThread::AcqThread(Camera& cam) : m_cam(cam), m_placement_gen(-1) {
+    AutoMutex aLock(m_cam.m_cond.mutex());
+    m_cam.m_wait_flag = true;
+    m_cam.m_quit = false;
+    aLock.unlock();
+    pthread_attr_setscope(&m_thread_attr, PTHREAD_SCOPE_PROCESS);
+}
+
+Camera::AcqThread::~AcqThread() {
+    AutoMutex aLock(m_cam.m_cond.mutex());
+    m_cam.m_quit = true;
     m_cam.m_cond.broadcast();
     aLock.unlock();
 }
 
 void Camera::ReadThread::threadFunction() {
     DEB_MEMBER_FUNCT();
-    AutoMutex aLock(m_cam.m_cond.mutex());
     StdBufferCbMgr& buffer_mgr = m_cam.m_bufferCtrlObj.getBuffer();
-
-    while (!m_cam.m_quit) {
-        while (m_cam.m_read_wait_flag && !m_cam.m_quit) {
-          DEB_TRACE() << "Read thread waiting";
-            m_cam.m_cond.wait();
+    FrameQueue::Range range;
+    bool continueFlag = true;
+
+    while (true) {
+        m_cam.m_placement.update(ThreadPlacement::Read, m_placement_gen);
+        m_cam.m_read_busy = true;
+        __sync_synchronize();
+        if (!m_cam.m_frame_queue.pop(range)) {
+            // queue drained, let a waiting acq thread complete then sleep until more frames arrive
+            m_cam.m_read_busy = false;
+            m_cam.notifyReadIdle();
+            AutoMutex aLock(m_cam.m_read_cond.mutex());
+            m_cam.m_read_sleeping = true;
+            __sync_synchronize();
+            if (m_cam.m_frame_queue.empty() && !m_cam.m_quit) {
+                DEB_TRACE() << "Read thread waiting";
+                m_cam.m_read_cond.wait();
+            }
+            m_cam.m_read_sleeping = false;
+            if (m_cam.m_quit) {
+                DEB_TRACE()  << "Read thread quit called";
+                return;
+            }
+            continue;
         }
-        DEB_TRACE() << "Read Thread Running";
-        if (m_cam.m_quit) {
-		DEB_TRACE()  << "Read thread quit called";
-            return;
+        DEB_TRACE() << "Read Thread Running " << DEB_VAR2(range.first_frame, range.nb_frames);
+        if (range.first_frame == 0) {
+            continueFlag = true;
+            m_cam.m_readout_frames = 0;
+            m_cam.m_read_time = 0;
+            m_cam.m_publish_time = 0;
         }
-
-        if (m_cam.m_abort) {
-            DEB_TRACE() << "User Aborted Acq, Read thread waiting";
-            m_cam.m_read_wait_flag = true;
+        if (m_cam.m_abort || !continueFlag) {
+            DEB_TRACE() << "Acq aborted, frames dropped";
             continue;
         }
 
-        aLock.unlock();
-
-        bool continueFlag = true;
-		double delta_time_readframe = 0;		
-		double delta_time_readframe_all = 0;
-		double delta_time_newframe = 0;
-		double delta_time_newframe_all = 0;
-		
-        while (continueFlag && (!m_cam.m_nb_frames || m_cam.m_read_frame_nb < m_cam.m_acq_frame_nb)) {
-            void* bptr = buffer_mgr.getFrameBufferPtr(m_cam.m_read_frame_nb);
-            DEB_TRACE() << "buffer pointer " << bptr;
-            DEB_TRACE() << "read histogram & scaler data frame number " << m_cam.m_read_frame_nb;
-			Timestamp t0_readframe = Timestamp::now();
-            m_cam.readFrame(bptr, m_cam.m_read_frame_nb);
-			Timestamp t1_readframe = Timestamp::now();
-			delta_time_readframe = (t1_readframe - t0_readframe);
-			delta_time_readframe_all+=delta_time_readframe;
-			 
-			Timestamp t0_newframe = Timestamp::now();
-            HwFrameInfoType frame_info;
-            frame_info.acq_frame_nb = m_cam.m_read_frame_nb;
-            continueFlag = buffer_mgr.newFrameReady(frame_info);           
-            ++m_cam.m_read_frame_nb;
-			Timestamp t1_newframe = Timestamp::now();
-			delta_time_newframe = (t1_newframe - t0_newframe); 
-			delta_time_newframe_all+=delta_time_newframe;
-			DEB_TRACE() << "readThread::threadFunction() newframe ready ";
-        }
-		DEB_TRACE() << "readFrame : elapsed time of " <<  m_cam.m_acq_frame_nb << " frames = "<< (int) (delta_time_readframe_all * 1000) << " (ms)";	
-		DEB_TRACE() << "newFrame : elapsed time of " <<  m_cam.m_acq_frame_nb << " frames = " << (int) (delta_time_newframe_all * 1000) << " (ms)";
-
-		
-        aLock.lock();
-        // if all frames read wakeup the acq thread
-        if (m_cam.m_nb_frames == m_cam.m_read_frame_nb) {
-            DEB_TRACE() << "broadcast to wake acq thread";
-            m_cam.m_cond.broadcast();
-            aLock.unlock();
+        int end_frame = range.first_frame + range.nb_frames;
+        while (continueFlag && !m_cam.m_abort && m_cam.m_read_frame_nb < end_frame) {
+            // read all the frames of the range in one go, up to the batch size
+            int read_frame_nb = m_cam.m_read_frame_nb;
+            int nb_frames = min(end_frame - read_frame_nb, m_cam.m_read_batch_size);
+            // the frames of a batch are only published once all are read, they must not wrap round the Lima
+            // buffers, nor overwrite the last frame published which Lima may still be processing
+            int nb_buffers;
+            buffer_mgr.getNbBuffers(nb_buffers);
+            nb_frames = min(nb_frames, max(nb_buffers - 1, 1));
+            if (m_cam.m_circ_buffer) {
+                // do not read across the wrap round of the circular buffer
+                nb_frames = min(nb_frames, m_cam.m_max_frames - read_frame_nb % m_cam.m_max_frames);
+            }
+            DEB_TRACE() << "read histogram & scaler data " << DEB_VAR2(read_frame_nb, nb_frames);
+            Timestamp t0_readframe = Timestamp::now();
+            if (m_cam.m_card_readout) {
+                m_cam.readFramesByCard(read_frame_nb, nb_frames);
+            } else if (m_cam.m_read_pool.getNbThreads() > 0) {
+                // the pool tasks also correct the Bpp32F frames
+                m_cam.readFramesByPool(read_frame_nb, nb_frames);
+            } else if (nb_frames > 1) {
+                m_cam.readFrames(read_frame_nb, nb_frames);
+            } else {
+                void* bptr = buffer_mgr.getFrameBufferPtr(read_frame_nb);
+                DEB_TRACE() << "buffer pointer " << bptr;
+                m_cam.readFrame(bptr, read_frame_nb);
+            }
+            if (m_cam.m_circ_buffer) {
+                m_cam.ackFrames(read_frame_nb, nb_frames);
+            }
+            if (m_cam.m_image_type == Bpp32F && (m_cam.m_card_readout || m_cam.m_read_pool.getNbThreads() == 0)) {
+                for (int i = 0; i < nb_frames; i++) {
+                    m_cam.correctFrame(buffer_mgr.getFrameBufferPtr(read_frame_nb + i));
+                }
+            }
+            if (m_cam.m_hdf_writer != NULL) {
+                m_cam.saveFrames(read_frame_nb, nb_frames);
+            }
+            Timestamp t1_readframe = Timestamp::now();
+            m_cam.m_read_time += t1_readframe - t0_readframe;
+
+            for (int i = 0; continueFlag && i < nb_frames; i++) {
+                HwFrameInfoType frame_info;
+                frame_info.acq_frame_nb = read_frame_nb + i;
+                continueFlag = buffer_mgr.newFrameReady(frame_info);
+                // publish the frame count after the frame contents
+                __sync_fetch_and_add(&m_cam.m_read_frame_nb, 1);
+            }
+            m_cam.m_publish_time += Timestamp::now() - t1_readframe;
+            m_cam.m_readout_frames += nb_frames;
         }
-        // This thread will now wait for next frame or acq
-        m_cam.m_read_wait_flag = true;
+        DEB_TRACE() << "readFrame : elapsed time of " <<  m_cam.m_readout_frames << " frames = "<< (int) (m_cam.m_read_time * 1000) << " (ms)";
+        DEB_TRACE() << "newFrame : elapsed time of " <<  m_cam.m_readout_frames << " frames = " << (int) (m_cam.m_publish_time * 1000) << " (ms)";
     }
 }
 
-Camera::ReadThread::ReadThread(Camera& cam) : m_cam(cam) {
-    AutoMutex aLock(m_cam.m_cond.mutex());
-    m_cam.m_read_wait_flag = true;
+Camera::ReadThread::ReadThread(Camera& cam) : m_cam(cam), m_placement_gen(-1) {
+    m_cam.m_read_busy = false;
+    m_cam.m_read_sleeping = false;
+    m_cam.m_acq_waiting = false;
     m_cam.m_quit = false;
-    aLock.unlock();
     pthread_attr_setscope(&m_thread_attr, PTHREAD_SCOPE_PROCESS);
 }
 
 Camera::ReadThread::~ReadThread() {
-    AutoMutex aLock(m_cam.m_cond.mutex());
+    AutoMutex aLock(m_cam.m_read_cond.mutex());
     m_cam.m_quit = true;
-    m_cam.m_cond.broadcast();
+    m_cam.m_read_cond.signal();
+    aLock.unlock();
+}
+
+Camera::CardReadThread::CardReadThread(Camera& cam, int card_nb) : m_cam(cam), m_card_nb(card_nb), m_placement_gen(-1),
+        m_quit(false) {
+    AutoMutex aLock(m_cam.m_card_cond.mutex());
+    m_job = m_cam.m_card_job;
+    aLock.unlock();
+    pthread_attr_setscope(&m_thread_attr, PTHREAD_SCOPE_PROCESS);
+}
+
+Camera::CardReadThread::~CardReadThread() {
+    AutoMutex aLock(m_cam.m_card_cond.mutex());
+    m_quit = true;
+    m_cam.m_card_cond.broadcast();
     aLock.unlock();
 }
 
+void Camera::CardReadThread::threadFunction() {
+    DEB_MEMBER_FUNCT();
+    AutoMutex aLock(m_cam.m_card_cond.mutex());
+
+    while (true) {
+        while (m_job == m_cam.m_card_job && !m_quit) {
+            m_cam.m_card_cond.wait();
+        }
+        if (m_quit) {
+            DEB_TRACE() << "Card read thread quit called";
+            return;
+        }
+        m_job = m_cam.m_card_job;
+        int first_frame = m_cam.m_card_first_frame;
+        int nb_frames = m_cam.m_card_nb_frames;
+        aLock.unlock();
+        m_cam.m_placement.update(ThreadPlacement::Read, m_placement_gen);
+
+        string error;
+        try {
+            m_cam.readCardFrames(m_cam.m_cards[m_card_nb], first_frame, nb_frames);
+        } catch (Exception& e) {
+            error = e.getErrMsg();
+        }
+
+        aLock.lock();
+        if (!error.empty() && m_cam.m_card_error.empty()) {
+            m_cam.m_card_error = error;
+        }
+        // the last card to complete publishes the frames
+        if (--m_cam.m_card_pending == 0) {
+            m_cam.m_card_cond.broadcast();
+        }
+    }
+}
+
+/**
+ * Wake the read thread if it is waiting for frames. The barrier pairs with the one in the read
+ * thread between setting m_read_sleeping and checking the queue, so a push is never missed.
+ */
+void Camera::wakeReadThread() {
+    __sync_synchronize();
+    if (m_read_sleeping) {
+        AutoMutex aLock(m_read_cond.mutex());
+        m_read_cond.signal();
+    }
+}
+
+/**
+ * Called by the read thread when it has drained the frame queue, wakes the acq thread if it is
+ * waiting for the read out to complete.
+ */
+void Camera::notifyReadIdle() {
+    __sync_synchronize();
+    if (m_acq_waiting) {
+        AutoMutex aLock(m_cond.mutex());
+        m_cond.broadcast();
+    }
+}
+
 void Camera::getImageType(ImageType& type) {
     DEB_MEMBER_FUNCT();
     type = m_image_type;
 }
 
+/**
+ * Set the image type of the Lima frames. Bpp32 frames hold the raw histograms and scalers,
+ * Bpp32F frames hold them dead time corrected by the read thread.
+ *
+ * @param[in] type Bpp32 or Bpp32F
+ */
 void Camera::setImageType(ImageType type) {
     DEB_MEMBER_FUNCT();
+    DEB_PARAM() << DEB_VAR1(type);
+    if (type != Bpp32 && type != Bpp32F) {
+        THROW_HW_ERROR(InvalidValue) << "Image type must be Bpp32 or Bpp32F " << DEB_VAR1(type);
+    }
     m_image_type = type;
 }
 
@@ -406,6 +1218,7 @@ void Camera::getDetectorType(std::string& type) {
 
 void Camera::getDetectorModel(std::string& model) {
     DEB_MEMBER_FUNCT();
+    waitInit();
     stringstream ss;
     int revision = xsp3_get_revision(m_handle);
     int major = (revision >> 12) & 0xfff;
@@ -429,18 +1242,25 @@ HwBufferCtrlObj* Camera::getBufferCtrlObj() {
     return &m_bufferCtrlObj;
 }
 
+/**
+ * Program the timing registers for the trigger mode, exposure time and number of frames.
+ */
 void Camera::setTimingMode() {
     DEB_MEMBER_FUNCT();
-    
-    if (!m_exp_time) return;
-    if (!m_nb_frames) return;
+    m_timing_valid = false;
 
     DEB_TRACE() << "Camera::setTimingMode() " << DEB_VAR1(m_trigger_mode) << "exp " << DEB_VAR1(m_exp_time) << "nbf " << m_nb_frames;
 
     int alt_ttl_mode = 0;
     int debounce = 80;
 
-    if (m_trigger_mode == IntTrig) {
+    if (isItfgTimed()) {
+        // the ITFG always runs a fixed number of frames, the exposure time is checked by setItfgTiming()
+        if (m_nb_frames <= 0) {
+            THROW_HW_ERROR(Error) << "Unbounded acquisition (0 frames) is only possible with ExtGate, the ITFG runs "
+                                  << "a fixed number of frames: set the number of frames, the circular buffer "
+                                  << "run mode allows more than the histogram memory holds";
+        }
         // Src 1 = Internal
         // setTiming(int time_src, int first_frame, int alt_ttl_mode, int debounce, bool loop_io, bool f0_invert, bool veto_invert);
         setCard(0);
@@ -451,14 +1271,66 @@ void Camera::setTimingMode() {
         }
         setCard(-1);
 
-        // setItfgTiming(int nframes, int triggerMode, int gapMode);
-        // triggerMode 0 = Burst, gapMode 3 = 1us
-        setItfgTiming(m_nb_frames, 0, 3);
+        // IntTrig runs all the frames back to back, IntTrigMult pauses before every
+        // frame until count enable is raised again by startAcq(), ExtTrigSingle and
+        // ExtTrigMult wait for TTL_IN(1) before the first or every frame
+        int itfg_mode;
+        switch (m_trigger_mode) {
+            case IntTrigMult:
+                itfg_mode = SoftwarePause;
+                break;
+            case ExtTrigSingle:
+                itfg_mode = HardwareOnlyFirst;
+                break;
+            case ExtTrigMult:
+                itfg_mode = HardwarePause;
+                break;
+            default:
+                itfg_mode = Burst;
+                break;
+        }
+        setItfgTiming(m_nb_frames, itfg_mode, Gap1us);
 
     } else if (m_trigger_mode == ExtGate) {
         // Src 4 = Ext
         setTiming(4, 0, alt_ttl_mode, debounce, false, false, false);
     }
+    m_timing_trig_mode = m_trigger_mode;
+    m_timing_exp_time = m_exp_time;
+    m_timing_nb_frames = m_nb_frames;
+    m_timing_valid = true;
+}
+
+/**
+ * Commit the staged trigger mode, exposure time and number of frames to the timing registers, unless they are
+ * already programmed with them.
+ */
+void Camera::commitTiming() {
+    DEB_MEMBER_FUNCT();
+    if (m_timing_valid && m_timing_trig_mode == m_trigger_mode && m_timing_exp_time == m_exp_time
+            && m_timing_nb_frames == m_nb_frames) {
+        DEB_TRACE() << "Timing unchanged";
+        return;
+    }
+    setTimingMode();
+}
+
+/**
+ * Get the number of timing register writes (global timing registers and ITFG set up) since the camera was created.
+ *
+ * @param[out] nb_writes the number of writes
+ */
+void Camera::getTimingWrites(long long& nb_writes) {
+    DEB_MEMBER_FUNCT();
+    nb_writes = m_timing_writes;
+}
+
+/**
+ * Check if the frames are timed by the internal time frame generator.
+ */
+bool Camera::isItfgTimed() const {
+    return m_trigger_mode == IntTrig || m_trigger_mode == IntTrigMult || m_trigger_mode == ExtTrigSingle
+            || m_trigger_mode == ExtTrigMult;
 }
 
 void Camera::setTrigMode(TrigMode mode) {
@@ -479,8 +1351,7 @@ void Camera::setTrigMode(TrigMode mode) {
         THROW_HW_ERROR(Error) << "Cannot change the Trigger Mode of the camera, this mode is not managed !";
         break;
     }
-
-    setTimingMode();
+    // staged, committed by prepareAcq()
 }
 
 void Camera::getTrigMode(TrigMode& mode) {
@@ -502,7 +1373,7 @@ void Camera::setExpTime(double exp_time) {
     DEB_TRACE() << "Camera::setExpTime() " << DEB_VAR1(exp_time);
 
     m_exp_time = exp_time;
-    setTimingMode();
+    // staged, committed by prepareAcq()
 }
 
 void Camera::setLatTime(double lat_time) {
@@ -541,7 +1412,7 @@ void Camera::setNbFrames(int nb_frames) {
         THROW_HW_ERROR(Error) << "Number of frames to acquire has not been set";
     }
     m_nb_frames = nb_frames;
-    setTimingMode();
+    // staged, committed by prepareAcq()
 }
 
 void Camera::getNbFrames(int& nb_frames) {
@@ -556,6 +1427,29 @@ bool Camera::isAcqRunning() const {
     return m_thread_running;
 }
 
+/**
+ * Get the current period used by the acquisition thread to poll the hardware progress.
+ *
+ * @param[out] period the poll period in seconds
+ */
+void Camera::getPollPeriod(double& period) {
+    DEB_MEMBER_FUNCT();
+    AutoMutex aLock(m_cond.mutex());
+    period = m_poll_period;
+}
+
+/**
+ * Get the latency of the last frame notification, i.e. the time between the last poll that
+ * found no new frame and the poll that signalled the read thread.
+ *
+ * @param[out] latency the notification latency in seconds
+ */
+void Camera::getNotifyLatency(double& latency) {
+    DEB_MEMBER_FUNCT();
+    AutoMutex aLock(m_cond.mutex());
+    latency = m_notify_latency;
+}
+
 /////////////////////////////////
 // xspress3 specific stuff now //
 /////////////////////////////////
@@ -570,6 +1464,7 @@ bool Camera::isAcqRunning() const {
 void Camera::setupClocks(ClockSrc clk_src, ClockFlags flags, int tp_type)
 {
     DEB_MEMBER_FUNCT();
+    waitInit();
     DEB_TRACE() << "Camera::setupClocks() " << DEB_VAR3(clk_src,flags,tp_type);
     if (xsp3_clocks_setup(m_handle, m_card, clk_src, flags, tp_type) < 0) {
         THROW_HW_ERROR(Error) << xsp3_get_error_message();
@@ -583,9 +1478,12 @@ void Camera::setupClocks(ClockSrc clk_src, ClockFlags flags, int tp_type)
  * @param[in] hist
  * @param[in] playback
  * @param[in] scope
+ * @param[in] circular continuous acquisition, frames wrap round in the histogram memory and are
+ *            acknowledged once read into the Lima buffers
  */
-void Camera::setRunMode(bool playback, bool scope, bool scalers, bool hist) {
+void Camera::setRunMode(bool playback, bool scope, bool scalers, bool hist, bool circular) {
     DEB_MEMBER_FUNCT();
+    waitInit();
     int flags = 0;
     if (playback)
         flags |= XSP3_RUN_FLAGS_PLAYBACK;
@@ -595,11 +1493,24 @@ void Camera::setRunMode(bool playback, bool scope, bool scalers, bool hist) {
         flags |= XSP3_RUN_FLAGS_SCALERS;
     if (hist)
         flags |= XSP3_RUN_FLAGS_HIST;
+    if (circular)
+        flags |= XSP3_RUN_FLAGS_CIRCULAR_BUFFER;
 
-    DEB_TRACE() << "Camera::setRunMode() " << DEB_VAR4(playback,scope,scalers,hist);
-    if (xsp3_set_run_flags(m_handle, flags) < 0) {
-        THROW_HW_ERROR(Error) << xsp3_get_error_message();
-    }
+    DEB_TRACE() << "Camera::setRunMode() " << DEB_VAR5(playback,scope,scalers,hist,circular);
+    setRunFlags(flags);
+    m_circ_buffer = circular;
+}
+
+/**
+ * Get the circular buffer (continuous acquisition) run mode
+ *
+ * @param[out] circular true if the circular buffer run flag is set
+ */
+void Camera::getCircularBuffer(bool& circular) {
+    DEB_MEMBER_FUNCT();
+    waitInit();
+    int flags = getRunFlags();
+    circular = flags & XSP3_RUN_FLAGS_CIRCULAR_BUFFER;
 }
 
 /**
@@ -610,10 +1521,8 @@ void Camera::setRunMode(bool playback, bool scope, bool scalers, bool hist) {
 void Camera::getRunMode(bool& playback, bool& scope, bool& scalers, bool& hist) {
 //void Camera::getRunMode(int& flags) {
     DEB_MEMBER_FUNCT();
-    int flags;
-    if ((flags = xsp3_get_run_flags(m_handle)) < 0) {
-        THROW_HW_ERROR(Error) << xsp3_get_error_message();
-    }
+    waitInit();
+    int flags = getRunFlags();
     playback = flags & XSP3_RUN_FLAGS_PLAYBACK;
     scope = flags & XSP3_RUN_FLAGS_SCOPE;
     scalers = flags & XSP3_RUN_FLAGS_SCALERS;
@@ -638,6 +1547,7 @@ void Camera::getNbScalers(int& nb_scalers) {
  */
 void Camera::getRevision(int& revision) {
     DEB_MEMBER_FUNCT();
+    waitInit();
     if ((revision = xsp3_get_revision(m_handle)) < 0) {
         THROW_HW_ERROR(Error) << xsp3_get_error_message();
     }
@@ -651,6 +1561,7 @@ void Camera::getRevision(int& revision) {
  */
 void Camera::initBrams(int chan) {
     DEB_MEMBER_FUNCT();
+    waitInit();
     DEB_TRACE() << "Camera::initBrams() " << DEB_VAR1(chan);
     if (xsp3_bram_init(m_handle, chan, -1, -1.0) < 0) {
         THROW_HW_ERROR(Error) << xsp3_get_error_message();
@@ -668,8 +1579,32 @@ void Camera::initBrams(int chan) {
  */
 void Camera::setWindow(int chan, int win, int low, int high) {
     DEB_MEMBER_FUNCT();
+    waitInit();
     DEB_TRACE() << "Camera::setWindow() " << DEB_VAR4(chan,win,low,high);
-    if (xsp3_set_window(m_handle, chan, win, low, high) < 0) {
+    AutoMutex aLock(m_reg_mutex);
+    int first_chan, last_chan;
+    bool cached = (win == 0 || win == 1) && getCachedChans(chan, first_chan, last_chan);
+    if (cached) {
+        bool same = true;
+        for (int i = first_chan; i < last_chan && same; i++) {
+            ChanRegs& regs = m_chan_regs[i];
+            same = regs.window_valid[win] && regs.window_low[win] == (u_int32_t)low && regs.window_high[win] == (u_int32_t)high;
+        }
+        if (same) {
+            m_reg_skipped++;
+            return;
+        }
+    }
+    int status = xsp3_set_window(m_handle, chan, win, low, high);
+    if (cached) {
+        for (int i = first_chan; i < last_chan; i++) {
+            ChanRegs& regs = m_chan_regs[i];
+            regs.window_valid[win] = status >= 0;
+            regs.window_low[win] = low;
+            regs.window_high[win] = high;
+        }
+    }
+    if (status < 0) {
         THROW_HW_ERROR(Error) << xsp3_get_error_message();
     }
 }
@@ -685,8 +1620,23 @@ void Camera::setWindow(int chan, int win, int low, int high) {
  */
 void Camera::getWindow(int chan, int win, u_int32_t& low, u_int32_t& high) {
     DEB_MEMBER_FUNCT();
-    if (xsp3_get_window(m_handle, chan, win, &low, &high) < 0) {
-        THROW_HW_ERROR(Error) << xsp3_get_error_message();
+    waitInit();
+    AutoMutex aLock(m_reg_mutex);
+    ChanRegs* regs = (win == 0 || win == 1) ? getChanRegs(chan) : NULL;
+    if (regs != NULL && regs->window_valid[win]) {
+        low = regs->window_low[win];
+        high = regs->window_high[win];
+        m_reg_hits++;
+    } else {
+        if (xsp3_get_window(m_handle, chan, win, &low, &high) < 0) {
+            THROW_HW_ERROR(Error) << xsp3_get_error_message();
+        }
+        m_reg_misses++;
+        if (regs != NULL) {
+            regs->window_low[win] = low;
+            regs->window_high[win] = high;
+            regs->window_valid[win] = true;
+        }
     }
     DEB_TRACE() << "Camera::getWindow() " << DEB_VAR4(chan,win,low,high);
 }
@@ -700,6 +1650,7 @@ void Camera::getWindow(int chan, int win, u_int32_t& low, u_int32_t& high) {
  */
 void Camera::setScaling(int chan, double scaling) {
     DEB_MEMBER_FUNCT();
+    waitInit();
     if (scaling >= 0.0 && (scaling < 0.5 || scaling > 2.0)) {
         THROW_HW_ERROR(Error) << "# Warning: large magnitude scaling "<< scaling << " on channel " << chan << ", should be 0.5 to 2.0";
     }
@@ -718,8 +1669,29 @@ void Camera::setScaling(int chan, double scaling) {
  */
 void Camera::setGoodThreshold(int chan, int good_thres) {
     DEB_MEMBER_FUNCT();
+    waitInit();
     DEB_TRACE() << "Camera::setGoodThreshold() " << DEB_VAR2(chan, good_thres);
-    if (xsp3_set_good_thres(m_handle, chan, good_thres) < 0) {
+    AutoMutex aLock(m_reg_mutex);
+    int first_chan, last_chan;
+    bool cached = getCachedChans(chan, first_chan, last_chan);
+    if (cached) {
+        bool same = true;
+        for (int i = first_chan; i < last_chan && same; i++) {
+            same = m_chan_regs[i].good_thres_valid && m_chan_regs[i].good_thres == (u_int32_t)good_thres;
+        }
+        if (same) {
+            m_reg_skipped++;
+            return;
+        }
+    }
+    int status = xsp3_set_good_thres(m_handle, chan, good_thres);
+    if (cached) {
+        for (int i = first_chan; i < last_chan; i++) {
+            m_chan_regs[i].good_thres_valid = status >= 0;
+            m_chan_regs[i].good_thres = good_thres;
+        }
+    }
+    if (status < 0) {
         THROW_HW_ERROR(Error) << xsp3_get_error_message();
     }
 }
@@ -732,35 +1704,172 @@ void Camera::setGoodThreshold(int chan, int good_thres) {
  */
 void Camera::getGoodThreshold(int chan, u_int32_t& good_thres) {
     DEB_MEMBER_FUNCT();
-    if (xsp3_get_good_thres(m_handle, chan, &good_thres) < 0) {
-        THROW_HW_ERROR(Error) << xsp3_get_error_message();
+    waitInit();
+    AutoMutex aLock(m_reg_mutex);
+    ChanRegs* regs = getChanRegs(chan);
+    if (regs != NULL && regs->good_thres_valid) {
+        good_thres = regs->good_thres;
+        m_reg_hits++;
+    } else {
+        if (xsp3_get_good_thres(m_handle, chan, &good_thres) < 0) {
+            THROW_HW_ERROR(Error) << xsp3_get_error_message();
+        }
+        m_reg_misses++;
+        if (regs != NULL) {
+            regs->good_thres = good_thres;
+            regs->good_thres_valid = true;
+        }
     }
     DEB_TRACE() << "Camera::getGoodThreshold() " << DEB_VAR2(chan, good_thres);
 }
 
 /**
- * Save all xspress3 settings into a file.
- *
- * @param[in] dir_name directory to save settings file.
+ * Save all xspress3 settings into the settings directory, both as the sdk text files and as a binary snapshot
+ * for restoreSettings(). The save runs in the background, {@link #getSaveSettingsStatus()} reports its progress.
  */
 void Camera::saveSettings() {
     DEB_MEMBER_FUNCT();
+    waitInit();
     DEB_TRACE() << "Camera::saveSettings() " << DEB_VAR1(m_config_directory_name);
+    if (m_config_directory_name.empty()) {
+        THROW_HW_ERROR(Error) << "No settings directory";
+    }
+    AutoMutex aLock(m_save_cond.mutex());
+    m_save_job++;
+    m_save_cond.broadcast();
+}
+
+/**
+ * Get the status of the background settings save.
+ *
+ * @param[out] busy true while a save is in progress
+ * @param[out] error the error of the last save, empty if it succeeded
+ */
+void Camera::getSaveSettingsStatus(bool& busy, string& error) {
+    DEB_MEMBER_FUNCT();
+    AutoMutex aLock(m_save_cond.mutex());
+    busy = m_save_done != m_save_job;
+    error = m_save_error;
+}
+
+void Camera::waitSaveSettings() {
+    DEB_MEMBER_FUNCT();
+    AutoMutex aLock(m_save_cond.mutex());
+    while (m_save_done != m_save_job) {
+        m_save_cond.wait();
+    }
+}
+
+/**
+ * Write the settings text files then the snapshot, which is then the newest file of the directory (used by the save
+ * thread only).
+ */
+void Camera::writeSettings() {
+    DEB_MEMBER_FUNCT();
     if (xsp3_save_settings(m_handle, (char*) m_config_directory_name.c_str()) < 0) {
         THROW_HW_ERROR(Error) << xsp3_get_error_message();
     }
+    SettingsSnapshot snapshot;
+    snapshot.read(m_handle, m_nb_cards, m_nb_chans);
+    snapshot.save(m_config_directory_name + "/" + SnapshotFileName);
+    DEB_TRACE() << "Settings saved " << DEB_VAR1(snapshot.getHash());
+}
+
+/**
+ * Check the settings snapshot exists and is not older than any other file of the settings directory, e.g. text
+ * settings saved by another sdk client.
+ */
+bool Camera::isSnapshotCurrent() {
+    DEB_MEMBER_FUNCT();
+    struct stat snap_stat;
+    string snap_name = m_config_directory_name + "/" + SnapshotFileName;
+    if (stat(snap_name.c_str(), &snap_stat) < 0) {
+        return false;
+    }
+    DIR* dir = opendir(m_config_directory_name.c_str());
+    if (dir == NULL) {
+        return false;
+    }
+    bool current = true;
+    struct dirent* entry;
+    while (current && (entry = readdir(dir)) != NULL) {
+        struct stat file_stat;
+        string name = m_config_directory_name + "/" + entry->d_name;
+        if (stat(name.c_str(), &file_stat) == 0 && S_ISREG(file_stat.st_mode) && file_stat.st_mtime > snap_stat.st_mtime) {
+            DEB_TRACE() << name << " is newer than the settings snapshot";
+            current = false;
+        }
+    }
+    closedir(dir);
+    return current;
+}
+
+/**
+ * Restore the settings from the snapshot, only writing the settings that differ from the hardware.
+ *
+ * @return false if the snapshot cannot be used, the settings are then restored from the text files
+ */
+bool Camera::restoreSnapshot(bool force_mismatch) {
+    DEB_MEMBER_FUNCT();
+    if (!isSnapshotCurrent()) {
+        return false;
+    }
+    try {
+        SettingsSnapshot snapshot, current;
+        snapshot.load(m_config_directory_name + "/" + SnapshotFileName);
+        current.read(m_handle, m_nb_cards, m_nb_chans);
+        if (snapshot.getRevision() != current.getRevision() && !force_mismatch) {
+            DEB_TRACE() << "Settings snapshot firmware revision " << snapshot.getRevision() << " does not match "
+                        << current.getRevision();
+            return false;
+        }
+        m_restore_writes = snapshot.restore(m_handle, current);
+        DEB_TRACE() << "Settings snapshot restored " << DEB_VAR3(snapshot.getHash(), current.getHash(), m_restore_writes);
+        return true;
+    } catch (Exception& e) {
+        DEB_WARNING() << "Settings snapshot not restored, using the text settings: " << e.getErrMsg();
+        return false;
+    }
+}
+
+/**
+ * Get how the last restoreSettings() went.
+ *
+ * @param[out] from_snapshot true if restored from the settings snapshot, false from the sdk text files
+ * @param[out] nb_writes the number of register or parameter writes (snapshot only, 0 when the hardware already held
+ *             the settings)
+ * @param[out] restore_time the restore time (s)
+ */
+void Camera::getRestoreStatus(bool& from_snapshot, int& nb_writes, double& restore_time) {
+    DEB_MEMBER_FUNCT();
+    from_snapshot = m_restore_snapshot;
+    nb_writes = m_restore_writes;
+    restore_time = m_restore_time;
 }
 
 /**
- * Restore all xspress3 settings from file.
+ * Restore all xspress3 settings from the settings directory, from the snapshot written by saveSettings() when it is
+ * the newest file of the directory, otherwise from the sdk text files. The register shadow is then reloaded on demand.
  *
- * @param[in] dir_name directory with saved settings file.
  * @param[in] force_mismatch force restore if major revision of saved file does not match the firmware revision.
  */
 void Camera::restoreSettings(bool force_mismatch) {
     DEB_MEMBER_FUNCT();
+    waitInit();
     DEB_TRACE() << "Camera::restoreSettings() " << DEB_VAR2(m_config_directory_name,force_mismatch);
-    if (xsp3_restore_settings(m_handle, (char*) m_config_directory_name.c_str(), force_mismatch) < 0) {
+    Timestamp t0 = Timestamp::now();
+    waitSaveSettings();
+    m_restore_writes = 0;
+    m_restore_snapshot = restoreSnapshot(force_mismatch);
+    int status = 0;
+    if (!m_restore_snapshot) {
+        status = xsp3_restore_settings(m_handle, (char*) m_config_directory_name.c_str(), force_mismatch);
+    }
+    m_restore_time = Timestamp::now() - t0;
+    // even a failed restore may have written some of the registers, the timing ones included
+    invalidateRegisterCache();
+    m_timing_valid = false;
+    if (status < 0) {
         THROW_HW_ERROR(Error) << xsp3_get_error_message();
     }
 }
@@ -777,6 +1886,7 @@ void Camera::restoreSettings(bool force_mismatch) {
  */
 void Camera::setRinging(int chan, double scale_a, int delay_a, double scale_b, int delay_b) {
     DEB_MEMBER_FUNCT();
+    waitInit();
     if (xsp3_set_trigger_b_ringing(m_handle, chan, scale_a, delay_a, scale_b, delay_b) < 0) {
         THROW_HW_ERROR(Error) << xsp3_get_error_message();
     }
@@ -789,6 +1899,7 @@ void Camera::setRinging(int chan, double scale_a, int delay_a, double scale_b, i
  */
 void Camera::setDeadtimeCalculationEnergy(double energy) {
     DEB_MEMBER_FUNCT();
+    waitInit();
     DEB_TRACE() << "Camera::setDeadtimeCalculationEnergy() " << DEB_VAR1(energy);
 
     if (xsp3_setDeadtimeCalculationEnergy(m_handle, energy) < 0) {
@@ -803,6 +1914,7 @@ void Camera::setDeadtimeCalculationEnergy(double energy) {
  */
 void Camera::getDeadtimeCalculationEnergy(double &energy) {
     DEB_MEMBER_FUNCT();
+    waitInit();
     if ((energy = xsp3_getDeadtimeCalculationEnergy(m_handle)) < 0.0) {
         THROW_HW_ERROR(Error) << xsp3_get_error_message();
     }
@@ -824,6 +1936,7 @@ void Camera::setDeadtimeCorrectionParameters(int chan, double processDeadTimeAll
         double processDeadTimeAllEventOffset, double processDeadTimeInWindowOffset, double processDeadTimeInWindowGradient,
         bool useGoodEvent, bool omitChannel) {
     DEB_MEMBER_FUNCT();
+    waitInit();
     int flags = 0;
     if (omitChannel)
         flags |= XSP3_DTC_OMIT_CHANNEL;
@@ -831,8 +1944,37 @@ void Camera::setDeadtimeCorrectionParameters(int chan, double processDeadTimeAll
         flags |= XSP3_DTC_USE_GOOD_EVENT;
     DEB_TRACE() << "Camera::setDeadtimeCorrectionParameters() " << DEB_VAR7(chan,processDeadTimeAllEventGradient,
             processDeadTimeAllEventOffset,processDeadTimeInWindowOffset,processDeadTimeInWindowGradient,useGoodEvent,omitChannel);
-    if (xsp3_setDeadtimeCorrectionParameters(m_handle, chan, flags, processDeadTimeAllEventGradient,
-        processDeadTimeAllEventOffset, processDeadTimeInWindowOffset, processDeadTimeInWindowGradient) < 0){
+    double params[4] = {processDeadTimeAllEventGradient, processDeadTimeAllEventOffset, processDeadTimeInWindowOffset,
+            processDeadTimeInWindowGradient};
+    AutoMutex aLock(m_reg_mutex);
+    int first_chan, last_chan;
+    bool cached = getCachedChans(chan, first_chan, last_chan);
+    if (cached) {
+        bool same = true;
+        for (int i = first_chan; i < last_chan && same; i++) {
+            ChanRegs& regs = m_chan_regs[i];
+            same = regs.dtc_valid && regs.dtc_flags == flags;
+            for (int j = 0; j < 4 && same; j++) {
+                same = regs.dtc_params[j] == params[j];
+            }
+        }
+        if (same) {
+            m_reg_skipped++;
+            return;
+        }
+    }
+    int status = xsp3_setDeadtimeCorrectionParameters(m_handle, chan, flags, params[0], params[1], params[2], params[3]);
+    if (cached) {
+        for (int i = first_chan; i < last_chan; i++) {
+            ChanRegs& regs = m_chan_regs[i];
+            regs.dtc_valid = status >= 0;
+            regs.dtc_flags = flags;
+            for (int j = 0; j < 4; j++) {
+                regs.dtc_params[j] = params[j];
+            }
+        }
+    }
+    if (status < 0) {
         THROW_HW_ERROR(Error) << xsp3_get_error_message();
     }
 }
@@ -853,10 +1995,14 @@ void Camera::getDeadtimeCorrectionParameters(int chan, double &processDeadTimeAl
         double &processDeadTimeAllEventOffset, double &processDeadTimeInWindowOffset, double &processDeadTimeInWindowGradient,
         bool &useGoodEvent, bool &omitChannel) {
     DEB_MEMBER_FUNCT();
-    int flags = 0;
-    if (xsp3_getDeadtimeCorrectionParameters(m_handle, chan, &flags, &processDeadTimeAllEventGradient, &processDeadTimeAllEventOffset, &processDeadTimeInWindowOffset, &processDeadTimeInWindowGradient) < 0) {
-        THROW_HW_ERROR(Error) << xsp3_get_error_message();
-    }
+    waitInit();
+    int flags;
+    double params[4];
+    getDtcParams(chan, flags, params);
+    processDeadTimeAllEventGradient = params[0];
+    processDeadTimeAllEventOffset = params[1];
+    processDeadTimeInWindowOffset = params[2];
+    processDeadTimeInWindowGradient = params[3];
     omitChannel = flags & XSP3_DTC_OMIT_CHANNEL;
     useGoodEvent = flags & XSP3_DTC_USE_GOOD_EVENT;
 }
@@ -868,6 +2014,7 @@ void Camera::getDeadtimeCorrectionParameters(int chan, double &processDeadTimeAl
  */
 void Camera::setFanSetpoint(int deg_c) {
     DEB_MEMBER_FUNCT();
+    waitInit();
     u_int32_t reg= deg_c*2;
     if (xsp3_write_fan_cont(m_handle, m_card, XSP3_FAN_OFFSET_SET_POINT, 1, &reg) < 0) {
         THROW_HW_ERROR(Error) << xsp3_get_error_message();
@@ -881,6 +2028,7 @@ void Camera::setFanSetpoint(int deg_c) {
  */
 void Camera::getFanTemperatures(Data& sensorData) {
     DEB_MEMBER_FUNCT();
+    waitInit();
     int n = (m_card == -1) ? m_nb_cards : m_card;
     u_int32_t reg[n*5];
     for (int card = 0; card < n; card++) {
@@ -892,12 +2040,11 @@ void Camera::getFanTemperatures(Data& sensorData) {
     sensorData.frameNumber = 0;
     sensorData.dimensions.push_back(5);
     sensorData.dimensions.push_back(n);
-    Buffer *buff = new Buffer();
-    double *sdata = new double[n*5];
+    Buffer *buff = BufferPool::getInstance().getBuffer(n * 5 * sizeof(double));
+    double *sdata = (double*)buff->data;
     for (int i = 0; i < n * 5; i++) {
         sdata[i] = 0.5 * reg[i];
     }
-    buff->data = sdata;
     sensorData.setBuffer(buff);
     buff->unref();
     DEB_TRACE() << "returning Data.size() " << sensorData.size();
@@ -911,6 +2058,7 @@ void Camera::getFanTemperatures(Data& sensorData) {
  */
 void Camera::setFanController(int p_term, int i_term) {
     DEB_MEMBER_FUNCT();
+    waitInit();
     u_int32_t reg[2];
     reg[0] = p_term;
     reg[1] = i_term;
@@ -926,6 +2074,7 @@ void Camera::setFanController(int p_term, int i_term) {
  */
 void Camera::arm() {
     DEB_MEMBER_FUNCT();
+    waitInit();
     if (xsp3_histogram_arm(m_handle, m_card) < 0) {
         THROW_HW_ERROR(Error) << xsp3_get_error_message();
     }
@@ -936,6 +2085,7 @@ void Camera::arm() {
  */
 void Camera::pause() {
     DEB_MEMBER_FUNCT();
+    waitInit();
     if (xsp3_histogram_pause(m_handle, m_card) < 0) {
         THROW_HW_ERROR(Error) << xsp3_get_error_message();
     }
@@ -947,6 +2097,7 @@ void Camera::pause() {
  */
 void Camera::restart() {
     DEB_MEMBER_FUNCT();
+    waitInit();
     if (xsp3_histogram_continue(m_handle, m_card) < 0) {
         THROW_HW_ERROR(Error) << xsp3_get_error_message();
     }
@@ -954,6 +2105,7 @@ void Camera::restart() {
 
 void Camera::start() {
     DEB_MEMBER_FUNCT();
+    waitInit();
     if (xsp3_histogram_start(m_handle, m_card) < 0){
         THROW_HW_ERROR(Error) << xsp3_get_error_message();
     }
@@ -961,19 +2113,48 @@ void Camera::start() {
 
 void Camera::stop() {
     DEB_MEMBER_FUNCT();
+    waitInit();
+    Timestamp start = Timestamp::now();
     if (xsp3_histogram_stop(m_handle, m_card) < 0){
         THROW_HW_ERROR(Error) << xsp3_get_error_message();
     }
+    // poll straight away, then back off from MinPollPeriod, until idle has been seen twice
+    double period = MinPollPeriod;
     int idleCount = 0;
-    while (idleCount < 2) {
+    while (true) {
+        int busy = xsp3_histogram_is_any_busy(m_handle);
+        if (busy < 0) {
+            THROW_HW_ERROR(Error) << xsp3_get_error_message();
+        }
+        if (busy == 0 && ++idleCount == 2) {
+            break;
+        }
+        if (Timestamp::now() - start > StopTimeout) {
+            DEB_WARNING() << "Histogramming still busy " << StopTimeout << " s after stop";
+            break;
+        }
         struct timespec delay, remain;
         delay.tv_sec = 0;
-        delay.tv_nsec = (int)(1E9*(0.01)); // sleep for 10msec
+        delay.tv_nsec = (long)(1E9 * period);
         nanosleep(&delay, &remain);
-        if (xsp3_histogram_is_any_busy(m_handle) == 0) {
-            ++idleCount;
-        }
+        period = min(period * 2, MaxStopPollPeriod);
     }
+    m_stop_time = Timestamp::now() - start;
+    DEB_TRACE() << DEB_VAR1(m_stop_time);
+}
+
+/**
+ * Get the duration of the last stop of the histogramming and, after stopAcq(), the time from
+ * the stopAcq() call until the status was back to Idle.
+ *
+ * @param[out] stop_time the time for the histogramming to be idle after the stop (s)
+ * @param[out] stop_latency the time from the last stopAcq() to Idle (s)
+ */
+void Camera::getStopLatency(double& stop_time, double& stop_latency) {
+    DEB_MEMBER_FUNCT();
+    AutoMutex aLock(m_cond.mutex());
+    stop_time = m_stop_time;
+    stop_latency = m_stop_latency;
 }
 
 /**
@@ -987,28 +2168,358 @@ void Camera::setClearMode(bool clear_flag) {
 }
 
 /**
- * Check which frames have been acquired
+ * Set how the histogram memory is cleared before each acquisition (when the clear mode is enabled).
+ * Only the frames written since the last clear are cleared. With the background strategies the
+ * clear runs with one thread per card, in blocks of frames from the first one, and startAcq() only
+ * waits for the frames of the acquisition if they are not cleared yet.
+ * With ClearAfterReadout the frames of an acquisition are cleared as soon as they are read, so the
+ * raw histograms (readRawHistogram) of an acquisition are not available after it.
  *
- * @param[out] frameNos the nos of frames of data acquired.
+ * @param[in] strategy ClearSync, ClearAtPrepare or ClearAfterReadout
  */
-void Camera::checkProgress(int& frameNos) {
+void Camera::setClearStrategy(ClearStrategy strategy) {
     DEB_MEMBER_FUNCT();
-    int fn = xsp3_scaler_check_progress(m_handle);
-    DEB_TRACE() << DEB_VAR1(fn);
-    if (fn < 0) {
-        THROW_HW_ERROR(Error) << xsp3_get_error_message();
+    DEB_PARAM() << DEB_VAR1(strategy);
+    if (isAcqRunning()) {
+        THROW_HW_ERROR(Error) << "Cannot change the clear strategy while acquiring";
     }
-    frameNos = fn;
+    if (strategy != ClearSync && m_clear_threads.empty()) {
+        if (m_cards.empty()) {
+            resolveCards();
+        }
+        AutoMutex aLock(m_clear_cond.mutex());
+        m_cleared.assign(m_cards.size(), m_clear_target);
+        aLock.unlock();
+        for (size_t i = 0; i < m_cards.size(); i++) {
+            m_clear_threads.push_back(new ClearThread(*this, i, m_cards[i].first_chan, m_cards[i].nb_chans));
+            m_clear_threads.back()->start();
+        }
+    }
+    m_clear_strategy = strategy;
+}
+
+void Camera::getClearStrategy(ClearStrategy& strategy) {
+    DEB_MEMBER_FUNCT();
+    strategy = m_clear_strategy;
 }
 
 /**
- * Select the currently active card
+ * Get the state of the histogram memory clear.
  *
- * @param[in] card is the number of the card in the xspress3 system,
- *        0 for a single card system and up to ({@link xsp3_get_num_cards()} - 1) for a multi-card system.
- *        If card is less than 0 then all cards are selected.
+ * @param[out] dirty_frames the frames written since the last clear was started
+ * @param[out] cleared_frames the frames cleared by the current or last background clear
+ * @param[out] wait_time the time the last startAcq() waited for the clear (s)
  */
-void Camera::setCard(int card) {
+void Camera::getClearStatus(int& dirty_frames, int& cleared_frames, double& wait_time) {
+    DEB_MEMBER_FUNCT();
+    AutoMutex aLock(m_clear_cond.mutex());
+    dirty_frames = m_dirty_frames;
+    cleared_frames = getClearedFrames();
+    wait_time = m_clear_wait;
+}
+
+/**
+ * Record that the first nb_frames frames of the histogram memory may have been written.
+ */
+void Camera::markDirty(int nb_frames) {
+    DEB_MEMBER_FUNCT();
+    AutoMutex aLock(m_clear_cond.mutex());
+    m_dirty_frames = max(m_dirty_frames, min(nb_frames, m_max_frames));
+    DEB_TRACE() << DEB_VAR1(m_dirty_frames);
+}
+
+/**
+ * Start the background clear of the dirty frames, after the previous one has completed. The frames
+ * are no longer dirty once handed to the clear, a failed clear makes them dirty again.
+ *
+ * @param[in] after_readout only clear the frames read, until the read thread has completed
+ */
+void Camera::startClear(bool after_readout) {
+    DEB_MEMBER_FUNCT();
+    AutoMutex aLock(m_clear_cond.mutex());
+    if (m_dirty_frames == 0 && m_clear_error.empty()) {
+        return;
+    }
+    while (m_clear_error.empty() && getClearedFrames() < m_clear_target) {
+        m_clear_cond.wait();
+    }
+    if (!m_clear_error.empty()) {
+        m_dirty_frames = max(m_dirty_frames, m_clear_target);
+        m_clear_error.clear();
+    }
+    if (m_dirty_frames == 0) {
+        return;
+    }
+    DEB_TRACE() << "Background clear " << DEB_VAR2(m_dirty_frames, after_readout);
+    m_clear_target = m_dirty_frames;
+    m_dirty_frames = 0;
+    m_cleared.assign(m_clear_threads.size(), 0);
+    m_clear_readout = after_readout;
+    m_clear_job++;
+    m_clear_cond.broadcast();
+}
+
+/**
+ * Wait until the first nb_frames frames are cleared.
+ */
+void Camera::waitCleared(int nb_frames) {
+    DEB_MEMBER_FUNCT();
+    Timestamp start = Timestamp::now();
+    AutoMutex aLock(m_clear_cond.mutex());
+    int needed = min(nb_frames, m_clear_target);
+    while (m_clear_error.empty() && getClearedFrames() < needed) {
+        m_clear_cond.wait();
+    }
+    m_clear_wait = Timestamp::now() - start;
+    DEB_TRACE() << DEB_VAR2(needed, m_clear_wait);
+    if (!m_clear_error.empty()) {
+        THROW_HW_ERROR(Error) << m_clear_error;
+    }
+}
+
+/**
+ * The frames cleared by all the cards, called with the clear condition locked.
+ */
+int Camera::getClearedFrames() {
+    int cleared = m_clear_target;
+    for (size_t i = 0; i < m_cleared.size(); i++) {
+        cleared = min(cleared, m_cleared[i]);
+    }
+    return cleared;
+}
+
+void Camera::stopClearThreads() {
+    DEB_MEMBER_FUNCT();
+    for (size_t i = 0; i < m_clear_threads.size(); i++) {
+        delete m_clear_threads[i];
+    }
+    m_clear_threads.clear();
+}
+
+Camera::ClearThread::ClearThread(Camera& cam, int card_nb, int first_chan, int nb_chans) : m_cam(cam), m_card_nb(card_nb),
+        m_first_chan(first_chan), m_nb_chans(nb_chans), m_placement_gen(-1), m_quit(false) {
+    AutoMutex aLock(m_cam.m_clear_cond.mutex());
+    m_job = m_cam.m_clear_job;
+    aLock.unlock();
+    pthread_attr_setscope(&m_thread_attr, PTHREAD_SCOPE_PROCESS);
+}
+
+Camera::ClearThread::~ClearThread() {
+    AutoMutex aLock(m_cam.m_clear_cond.mutex());
+    m_quit = true;
+    m_cam.m_clear_cond.broadcast();
+    aLock.unlock();
+}
+
+void Camera::ClearThread::threadFunction() {
+    DEB_MEMBER_FUNCT();
+    AutoMutex aLock(m_cam.m_clear_cond.mutex());
+
+    while (true) {
+        while (m_job == m_cam.m_clear_job && !m_quit) {
+            m_cam.m_clear_cond.wait();
+        }
+        if (m_quit) {
+            return;
+        }
+        m_job = m_cam.m_clear_job;
+        aLock.unlock();
+        m_cam.m_placement.update(ThreadPlacement::Read, m_placement_gen);
+        aLock.lock();
+
+        // clear from the first frame, so that startAcq() can go as soon as the frames it needs are clear
+        while (!m_quit && m_job == m_cam.m_clear_job && m_cam.m_clear_error.empty()) {
+            int first_frame = m_cam.m_cleared[m_card_nb];
+            int end_frame = min(first_frame + ClearChunkFrames, m_cam.m_clear_target);
+            if (m_cam.m_clear_readout) {
+                end_frame = min(end_frame, (int)m_cam.m_read_frame_nb);
+            }
+            if (first_frame >= m_cam.m_clear_target) {
+                break;
+            }
+            if (end_frame <= first_frame) {
+                // following the readout of the last acquisition
+                m_cam.m_clear_cond.wait(MinPollPeriod * 10);
+                continue;
+            }
+            aLock.unlock();
+            int ret = xsp3_histogram_clear(m_cam.m_handle, m_first_chan, m_nb_chans, first_frame, end_frame - first_frame);
+            aLock.lock();
+            if (ret < 0) {
+                m_cam.m_clear_error = xsp3_get_error_message();
+                DEB_ERROR() << "Histogram clear of channels " << m_first_chan << "-" << m_first_chan + m_nb_chans - 1
+                            << " failed: " << m_cam.m_clear_error;
+            } else {
+                m_cam.m_cleared[m_card_nb] = end_frame;
+            }
+            m_cam.m_clear_cond.broadcast();
+        }
+    }
+}
+
+Camera::InitThread::InitThread(Camera& cam) : m_cam(cam) {
+    pthread_attr_setscope(&m_thread_attr, PTHREAD_SCOPE_PROCESS);
+}
+
+Camera::InitThread::~InitThread() {
+}
+
+void Camera::InitThread::threadFunction() {
+    DEB_MEMBER_FUNCT();
+    try {
+        m_cam.init();
+    } catch (Exception& e) {
+        // kept in m_init_error, reported by getInitState() and the hardware calls
+        DEB_ERROR() << e.getErrMsg();
+    }
+}
+
+Camera::SaveThread::SaveThread(Camera& cam) : m_cam(cam), m_placement_gen(-1), m_quit(false) {
+    pthread_attr_setscope(&m_thread_attr, PTHREAD_SCOPE_PROCESS);
+}
+
+Camera::SaveThread::~SaveThread() {
+    AutoMutex aLock(m_cam.m_save_cond.mutex());
+    m_quit = true;
+    m_cam.m_save_cond.broadcast();
+    aLock.unlock();
+}
+
+void Camera::SaveThread::threadFunction() {
+    DEB_MEMBER_FUNCT();
+    AutoMutex aLock(m_cam.m_save_cond.mutex());
+
+    while (true) {
+        while (m_cam.m_save_done == m_cam.m_save_job && !m_quit) {
+            m_cam.m_save_cond.wait();
+        }
+        if (m_quit) {
+            return;
+        }
+        // saves requested meanwhile are covered by this one
+        int job = m_cam.m_save_job;
+        aLock.unlock();
+        m_cam.m_placement.update(ThreadPlacement::Writer, m_placement_gen);
+        string error;
+        try {
+            m_cam.writeSettings();
+        } catch (Exception& e) {
+            error = e.getErrMsg();
+            DEB_ERROR() << "Settings save failed: " << error;
+        }
+        aLock.lock();
+        m_cam.m_save_error = error;
+        m_cam.m_save_done = job;
+        m_cam.m_save_cond.broadcast();
+    }
+}
+
+/**
+ * Check which frames have been acquired
+ *
+ * @param[out] frameNos the nos of frames of data acquired.
+ */
+void Camera::checkProgress(int& frameNos) {
+    DEB_MEMBER_FUNCT();
+    waitInit();
+    if (m_circ_buffer) {
+        // 64 bit extended frame count, the frames wrap round in the histogram memory
+        Xsp3ErrFlag flags;
+        int64_t furthest_frame;
+        int64_t fn = xsp3_scaler_check_progress_details(m_handle, &flags, 1, &furthest_frame);
+        DEB_TRACE() << DEB_VAR3(fn, flags, furthest_frame);
+        if (fn < 0) {
+            THROW_HW_ERROR(Error) << xsp3_get_error_message();
+        }
+        if (flags & Xsp3ErrFlag_CircBuffOverRun) {
+            DEB_WARNING() << "Circular buffer overrun detected at frame " << fn;
+        }
+        frameNos = (fn > INT_MAX) ? INT_MAX : (int)fn;
+        return;
+    }
+    int fn = xsp3_scaler_check_progress(m_handle);
+    DEB_TRACE() << DEB_VAR1(fn);
+    if (fn < 0) {
+        THROW_HW_ERROR(Error) << xsp3_get_error_message();
+    }
+    frameNos = fn;
+}
+
+/**
+ * Acknowledge frames copied into the Lima buffers in circular buffer mode (used by read thread only),
+ * so that the receive threads can reuse them. The extended frame number of the frames is checked
+ * against the expected one and any new overrun is reported per channel.
+ *
+ * @param[in] first_frame the first time frame to acknowledge
+ * @param[in] nb_frames the number of time frames, must not cross the wrap round of the buffer
+ */
+void Camera::ackFrames(int first_frame, int nb_frames) {
+    DEB_MEMBER_FUNCT();
+    // the sdk addresses the frames in the histogram memory, the batch does not cross its end
+    int hw_frame = first_frame % m_max_frames;
+    m_tf_status.resize(nb_frames);
+    if (xsp3_histogram_get_tf_status_block(m_handle, 0, hw_frame, nb_frames, &m_tf_status[0]) < 0) {
+        THROW_HW_ERROR(Error) << xsp3_get_error_message();
+    }
+    for (int i = 0; i < nb_frames; i++) {
+        if (m_tf_status[i].time_frame != (int64_t)first_frame + i) {
+            DEB_WARNING() << "Frame " << first_frame + i << " holds extended time frame " << m_tf_status[i].time_frame;
+        }
+    }
+    if (xsp3_histogram_circ_ack(m_handle, 0, hw_frame, m_nb_chans, nb_frames) < 0) {
+        THROW_HW_ERROR(Error) << xsp3_get_error_message();
+    }
+    for (int chan = 0; chan < m_nb_chans; chan++) {
+        int64_t first_overrun;
+        int64_t num_overrun = xsp3_histogram_get_circ_overrun(m_handle, chan, &first_overrun);
+        if (num_overrun > m_circ_overruns[chan]) {
+            DEB_ERROR() << "Channel " << chan << " circular buffer overrun: " << num_overrun
+                        << " frames overwritten, first " << first_overrun;
+            m_circ_overruns[chan] = num_overrun;
+        }
+    }
+    AutoMutex aLock(m_cond.mutex());
+    m_ext_frame_nb = m_tf_status[nb_frames - 1].time_frame;
+}
+
+/**
+ * Get the circular buffer overrun count of a channel.
+ *
+ * @param[in] chan is the number of the channel in the xspress3 system, 0 to ({@link xsp3_get_num_chan()} - 1)
+ * @param[out] num_overrun the number of frames overwritten before being read
+ * @param[out] first_overrun the first frame overwritten
+ */
+void Camera::getCircOverrun(int chan, long long& num_overrun, long long& first_overrun) {
+    DEB_MEMBER_FUNCT();
+    waitInit();
+    int64_t first;
+    int64_t num = xsp3_histogram_get_circ_overrun(m_handle, chan, &first);
+    if (num < 0) {
+        THROW_HW_ERROR(Error) << xsp3_get_error_message();
+    }
+    num_overrun = num;
+    first_overrun = first;
+}
+
+/**
+ * Get the 64 bit extended frame number of the last frame read in circular buffer mode.
+ *
+ * @param[out] frame_nb the extended frame number or -1 if no frame was read yet
+ */
+void Camera::getExtFrameNumber(long long& frame_nb) {
+    DEB_MEMBER_FUNCT();
+    AutoMutex aLock(m_cond.mutex());
+    frame_nb = m_ext_frame_nb;
+}
+
+/**
+ * Select the currently active card
+ *
+ * @param[in] card is the number of the card in the xspress3 system,
+ *        0 for a single card system and up to ({@link xsp3_get_num_cards()} - 1) for a multi-card system.
+ *        If card is less than 0 then all cards are selected.
+ */
+void Camera::setCard(int card) {
     DEB_MEMBER_FUNCT();
     m_card = card;
 }
@@ -1034,6 +2545,7 @@ void Camera::getCard(int& card) {
  */
 void Camera::getNumChan(int& nb_chans) {
     DEB_MEMBER_FUNCT();
+    waitInit();
     nb_chans = xsp3_get_num_chan(m_handle);
 }
 
@@ -1045,6 +2557,7 @@ void Camera::getNumChan(int& nb_chans) {
  */
 void Camera::getNumCards(int& nb_cards) {
     DEB_MEMBER_FUNCT();
+    waitInit();
     nb_cards = xsp3_get_num_cards(m_handle);
 }
 
@@ -1056,6 +2569,7 @@ void Camera::getNumCards(int& nb_cards) {
  */
 void Camera::getChansPerCard(int& chans_per_card) {
     DEB_MEMBER_FUNCT();
+    waitInit();
     chans_per_card = xsp3_get_chans_per_card(m_handle);
 }
 
@@ -1067,6 +2581,7 @@ void Camera::getChansPerCard(int& chans_per_card) {
  */
 void Camera::getBinsPerMca(int& bins_per_mca) {
     DEB_MEMBER_FUNCT();
+    waitInit();
     bins_per_mca = xsp3_get_bins_per_mca(m_handle);
 }
 
@@ -1078,6 +2593,7 @@ void Camera::getBinsPerMca(int& bins_per_mca) {
  */
 void Camera::getMaxNumChan(int &max_chan) {
     DEB_MEMBER_FUNCT();
+    waitInit();
     max_chan = xsp3_get_max_num_chan(m_handle);
 }
 
@@ -1089,6 +2605,7 @@ void Camera::getMaxNumChan(int &max_chan) {
  */
 void Camera::initRoi(int chan) {
     DEB_MEMBER_FUNCT();
+    waitInit();
     if (xsp3_init_roi(m_handle, chan) < 0) {
         THROW_HW_ERROR(Error) << xsp3_get_error_message();
     }
@@ -1105,6 +2622,7 @@ void Camera::initRoi(int chan) {
  */
 void Camera::setRoi(int chan, Xsp3Roi& roi, int& nbins) {
     DEB_MEMBER_FUNCT();
+    waitInit();
     DEB_TRACE() << "Camera::setRoi - " << DEB_VAR2(chan,roi);
     int num_roi = roi.getNumRoi();
     XSP3Roi rois[num_roi];
@@ -1131,6 +2649,28 @@ void Camera::setUseDtc(bool flag) {
     m_use_dtc = flag;
 }
 
+/**
+ * Return dead time corrected histograms as float32 rather than double
+ *
+ * @param flag enable or disable float32 output
+ */
+void Camera::getDtcFloat(bool &flag) {
+    flag = m_dtc_float;
+}
+
+void Camera::setDtcFloat(bool flag) {
+    m_dtc_float = flag;
+}
+
+/**
+ * Get the instruction set used by the dead time correction kernel
+ *
+ * @param[out] isa AVX2, SSE2 or Scalar
+ */
+void Camera::getDtcIsa(string& isa) {
+    isa = DtcKernel::getIsaName(m_dtc_kernel.getIsa());
+}
+
 /**
  * Read a frame of xspress3 data comprising histogram & scaler data (used by read thread only).
  * The scaler data is added to the end of each channel of histogram data
@@ -1150,25 +2690,781 @@ void Camera::setUseDtc(bool flag) {
  * @param bptr a pointer to the buffer for the returned data
  * @param frame_nb is the time frame
  */
-void Camera::readFrame(void *fptr, int frame_nb) {
+void Camera::readFrame(void *fptr, int frame_nb) {
+    DEB_MEMBER_FUNCT();
+    u_int32_t* bptr = (u_int32_t*)fptr;
+    m_scaler_buffer.resize(m_nscalers * m_nb_chans);
+    u_int32_t* scalerData = &m_scaler_buffer[0];
+
+    // frame in the histogram memory, frame_nb wraps round it in circular buffer mode
+    int hw_frame = frame_nb % m_max_frames;
+    DEB_TRACE() << "Camera::readFrame() scalers " << DEB_VAR2(frame_nb, m_nb_chans);
+    if (xsp3_scaler_read(m_handle, scalerData, 0, 0, hw_frame, m_nscalers, m_nb_chans, 1) < 0) {
+        THROW_HW_ERROR(Error) << xsp3_get_error_message();
+    }
+    for (int chan=0; chan<m_nb_chans; chan++) {
+        DEB_TRACE() << "Camera::readFrame() histogram " << DEB_VAR3(frame_nb, m_npixels, chan);
+        if (xsp3_histogram_read3d(m_handle, (u_int32_t*) bptr, 0, chan, hw_frame, m_npixels, 1, 1) < 0) {
+            THROW_HW_ERROR(Error) << xsp3_get_error_message();
+        }
+        bptr += m_npixels;
+        for (int i=0; i<m_nscalers; i++) {
+            *bptr++ = scalerData[chan*m_nscalers+i];
+        }
+    }
+}
+
+/**
+ * Read a block of consecutive frames of xspress3 data with a single scaler and a single histogram read
+ * (used by read thread only). The data is then scattered into the Lima frame buffers with the same
+ * layout as {@link #readFrame()}.
+ *
+ * @param first_frame the first time frame to read
+ * @param nb_frames the number of time frames to read
+ */
+void Camera::readFrames(int first_frame, int nb_frames) {
+    DEB_MEMBER_FUNCT();
+    StdBufferCbMgr& buffer_mgr = m_bufferCtrlObj.getBuffer();
+    m_scaler_buffer.resize((size_t)nb_frames * m_nb_chans * m_nscalers);
+
+    // frames in the histogram memory, the block does not cross its end
+    int hw_frame = first_frame % m_max_frames;
+    DEB_TRACE() << "Camera::readFrames() " << DEB_VAR3(first_frame, nb_frames, m_nb_chans);
+    if (xsp3_scaler_read(m_handle, &m_scaler_buffer[0], 0, 0, hw_frame, m_nscalers, m_nb_chans, nb_frames) < 0) {
+        THROW_HW_ERROR(Error) << xsp3_get_error_message();
+    }
+    m_hist_buffer.resize((size_t)nb_frames * m_nb_chans * m_npixels);
+    if (xsp3_histogram_read4d(m_handle, &m_hist_buffer[0], 0, 0, 0, hw_frame, m_npixels, 1, m_nb_chans, nb_frames) < 0) {
+        THROW_HW_ERROR(Error) << xsp3_get_error_message();
+    }
+    u_int32_t* hptr = &m_hist_buffer[0];
+    u_int32_t* sptr = &m_scaler_buffer[0];
+    for (int frame = 0; frame < nb_frames; frame++) {
+        u_int32_t* bptr = (u_int32_t*) buffer_mgr.getFrameBufferPtr(first_frame + frame);
+        for (int chan = 0; chan < m_nb_chans; chan++) {
+            memcpy(bptr, hptr, m_npixels * sizeof(u_int32_t));
+            bptr += m_npixels;
+            hptr += m_npixels;
+            memcpy(bptr, sptr, m_nscalers * sizeof(u_int32_t));
+            bptr += m_nscalers;
+            sptr += m_nscalers;
+        }
+    }
+}
+
+/**
+ * Read a block of consecutive frames with one read thread per card (used by read thread only).
+ * Each card thread reads the histograms and scalers of its own channels into the Lima frames,
+ * the call returns once all the cards have completed.
+ *
+ * @param first_frame the first time frame to read
+ * @param nb_frames the number of time frames to read
+ */
+void Camera::readFramesByCard(int first_frame, int nb_frames) {
+    DEB_MEMBER_FUNCT();
+    StdBufferCbMgr& buffer_mgr = m_bufferCtrlObj.getBuffer();
+    m_card_frame_ptrs.resize(nb_frames);
+    for (int frame = 0; frame < nb_frames; frame++) {
+        m_card_frame_ptrs[frame] = buffer_mgr.getFrameBufferPtr(first_frame + frame);
+    }
+
+    AutoMutex aLock(m_card_cond.mutex());
+    m_card_first_frame = first_frame;
+    m_card_nb_frames = nb_frames;
+    m_card_pending = m_card_threads.size();
+    m_card_error.clear();
+    m_card_job++;
+    m_card_cond.broadcast();
+    while (m_card_pending > 0) {
+        m_card_cond.wait();
+    }
+    if (!m_card_error.empty()) {
+        THROW_HW_ERROR(Error) << m_card_error;
+    }
+}
+
+/**
+ * Read a block of consecutive frames of the channels of one card into the Lima frames
+ * (used by the card read threads only), with the same layout as {@link #readFrame()}.
+ *
+ * @param card the card
+ * @param first_frame the first time frame to read
+ * @param nb_frames the number of time frames to read
+ */
+void Camera::readCardFrames(CardInfo& card, int first_frame, int nb_frames) {
+    DEB_MEMBER_FUNCT();
+    card.scaler_buffer.resize((size_t)nb_frames * card.nb_chans * m_nscalers);
+
+    int hw_frame = first_frame % m_max_frames;
+    DEB_TRACE() << "Camera::readCardFrames() " << DEB_VAR3(card.card, first_frame, nb_frames);
+    if (xsp3_scaler_read(card.path, &card.scaler_buffer[0], 0, card.chan_idx, hw_frame, m_nscalers, card.nb_chans, nb_frames) < 0) {
+        THROW_HW_ERROR(Error) << xsp3_get_error_message();
+    }
+    card.hist_buffer.resize((size_t)nb_frames * card.nb_chans * m_npixels);
+    if (xsp3_histogram_read4d(card.path, &card.hist_buffer[0], 0, 0, card.chan_idx, hw_frame, m_npixels, 1, card.nb_chans, nb_frames) < 0) {
+        THROW_HW_ERROR(Error) << xsp3_get_error_message();
+    }
+    u_int32_t* hptr = &card.hist_buffer[0];
+    u_int32_t* sptr = &card.scaler_buffer[0];
+    for (int frame = 0; frame < nb_frames; frame++) {
+        u_int32_t* bptr = (u_int32_t*)m_card_frame_ptrs[frame] + card.first_chan * (m_npixels + m_nscalers);
+        for (int chan = card.first_chan; chan < card.first_chan + card.nb_chans; chan++) {
+            memcpy(bptr, hptr, m_npixels * sizeof(u_int32_t));
+            bptr += m_npixels;
+            hptr += m_npixels;
+            memcpy(bptr, sptr, m_nscalers * sizeof(u_int32_t));
+            bptr += m_nscalers;
+            sptr += m_nscalers;
+        }
+    }
+}
+
+void Camera::ReadTask::setFrames(int first_frame, int nb_frames) {
+    StdBufferCbMgr& buffer_mgr = m_cam.m_bufferCtrlObj.getBuffer();
+    m_first_frame = first_frame;
+    m_frame_ptrs.resize(nb_frames);
+    for (int frame = 0; frame < nb_frames; frame++) {
+        m_frame_ptrs[frame] = buffer_mgr.getFrameBufferPtr(first_frame + frame);
+    }
+}
+
+/**
+ * Calculate the dead time correction factors of the block from its scalers, one sdk call per frame.
+ */
+void Camera::ReadTask::calcDtcFactors() {
+    int nb_frames = m_frame_ptrs.size();
+    int nb_chans = m_cam.m_nb_chans;
+    m_factors.resize((size_t)nb_frames * nb_chans);
+    m_all_event.resize((size_t)nb_frames * nb_chans);
+    m_flags.resize((size_t)nb_frames * nb_chans);
+    for (int frame = 0; frame < nb_frames; frame++) {
+        size_t idx = (size_t)frame * nb_chans;
+        m_cam.calcDtcFactors(&m_cam.m_scaler_buffer[idx * m_cam.m_nscalers], m_cam.m_nscalers, 0, nb_chans,
+                &m_factors[idx], &m_all_event[idx], &m_flags[idx]);
+    }
+}
+
+void Camera::ReadTask::run(int frame, int chan) {
+    size_t idx = (size_t)frame * m_cam.m_nb_chans + chan;
+    const u_int32_t* scalers = &m_cam.m_scaler_buffer[idx * m_cam.m_nscalers];
+    m_cam.readChannel(m_frame_ptrs[frame], m_first_frame + frame, chan, scalers);
+    if (m_cam.m_image_type == Bpp32F) {
+        u_int32_t* bptr = (u_int32_t*)m_frame_ptrs[frame] + chan * (m_cam.m_npixels + m_cam.m_nscalers);
+        m_cam.correctChannel(bptr, m_factors[idx], m_all_event[idx], m_flags[idx]);
+    }
+}
+
+/**
+ * Read a block of consecutive frames with the read pool (used by read thread only). The scalers of
+ * the block are read in one go, and for Bpp32F frames the dead time correction factors calculated
+ * from them, then the histogram read and dead time correction of every frame and channel are shared
+ * between the pool threads. The call returns once every frame is complete.
+ *
+ * @param first_frame the first time frame to read
+ * @param nb_frames the number of time frames to read
+ */
+void Camera::readFramesByPool(int first_frame, int nb_frames) {
+    DEB_MEMBER_FUNCT();
+    m_scaler_buffer.resize((size_t)nb_frames * m_nb_chans * m_nscalers);
+    if (xsp3_scaler_read(m_handle, &m_scaler_buffer[0], 0, 0, first_frame % m_max_frames, m_nscalers, m_nb_chans, nb_frames) < 0) {
+        THROW_HW_ERROR(Error) << xsp3_get_error_message();
+    }
+    m_read_task->setFrames(first_frame, nb_frames);
+    if (m_image_type == Bpp32F) {
+        m_read_task->calcDtcFactors();
+    }
+    m_read_pool.run(*m_read_task, nb_frames, m_nb_chans);
+}
+
+/**
+ * Read the histogram of one channel of a frame and copy its scalers into the Lima frame (used by
+ * the read pool threads only). The sdk is not documented as thread safe, its histogram reads are
+ * serialised (the error message is global too), the copies and corrections run in parallel.
+ *
+ * @param fptr the Lima frame
+ * @param frame_nb the time frame
+ * @param chan the channel
+ * @param scalers the scalers of the channel
+ */
+void Camera::readChannel(void* fptr, int frame_nb, int chan, const u_int32_t* scalers) {
+    DEB_MEMBER_FUNCT();
+    int stride = m_npixels + m_nscalers;
+    u_int32_t* bptr = (u_int32_t*)fptr + chan * stride;
+    int hw_frame = frame_nb % m_max_frames;
+    {
+        AutoMutex aLock(m_sdk_mutex);
+        if (xsp3_histogram_read3d(m_handle, bptr, 0, chan, hw_frame, m_npixels, 1, 1) < 0) {
+            THROW_HW_ERROR(Error) << "channel " << chan << ": " << xsp3_get_error_message();
+        }
+    }
+    memcpy(bptr + m_npixels, scalers, m_nscalers * sizeof(u_int32_t));
+}
+
+/**
+ * Set the number of read pool threads. With 0 (default) the read thread reads the frames itself,
+ * otherwise the histogram read and dead time correction of each frame and channel are spread over
+ * the pool threads, which steal work from each other. Ignored with the per card readout.
+ *
+ * @param[in] nb_threads the number of read pool threads
+ */
+void Camera::setReadThreads(int nb_threads) {
+    DEB_MEMBER_FUNCT();
+    DEB_PARAM() << DEB_VAR1(nb_threads);
+    if (isAcqRunning()) {
+        THROW_HW_ERROR(Error) << "Cannot change the readout mode while acquiring";
+    }
+    m_read_pool.setNbThreads(nb_threads);
+}
+
+void Camera::getReadThreads(int& nb_threads) {
+    DEB_MEMBER_FUNCT();
+    nb_threads = m_read_pool.getNbThreads();
+}
+
+/**
+ * Get the number of read pool tasks run and of tasks stolen by a thread from another one.
+ */
+void Camera::getReadPoolStats(long long& nb_tasks, long long& nb_stolen) {
+    DEB_MEMBER_FUNCT();
+    m_read_pool.getStats(nb_tasks, nb_stolen);
+}
+
+/**
+ * Get the readout timers of the current or last acquisition, to compare the readout modes.
+ *
+ * @param[out] nb_frames the number of frames read
+ * @param[out] read_time the time spent reading (and correcting) them (s)
+ * @param[out] publish_time the time spent passing them to Lima (s)
+ */
+void Camera::getReadoutTime(int& nb_frames, double& read_time, double& publish_time) {
+    DEB_MEMBER_FUNCT();
+    nb_frames = m_readout_frames;
+    read_time = m_read_time;
+    publish_time = m_publish_time;
+}
+
+/**
+ * Set the cpu set and scheduling of a thread role. The plugin threads (acq, read, including the read
+ * pool and per card read threads, and writer) apply it themselves the next time they wake up, at the
+ * latest at the next acquisition. The sdk histogram receive (hist) and scope threads are given the cpu
+ * set straight away, the sdk does not support a priority for them.
+ *
+ * @param[in] role hist, scope, acq, read or writer
+ * @param[in] cpus the cpu list, as for taskset -c, empty for no affinity
+ * @param[in] priority the SCHED_FIFO priority, 0 for SCHED_OTHER
+ */
+void Camera::setThreadPlacement(string role, string cpus, int priority) {
+    DEB_MEMBER_FUNCT();
+    DEB_PARAM() << DEB_VAR3(role, cpus, priority);
+    ThreadPlacement::Role r = ThreadPlacement::getRole(role);
+    if ((r == ThreadPlacement::Hist || r == ThreadPlacement::Scope) && priority != 0) {
+        THROW_HW_ERROR(NotSupported) << "No priority control of the sdk " << role << " threads";
+    }
+    m_placement.set(r, cpus, priority);
+    applySdkPlacement(r);
+}
+
+/**
+ * Get the placement requested for a thread role and the one actually applied, as read back from
+ * the system by the last thread of the role to apply it.
+ *
+ * @param[in] role hist, scope, acq, read or writer
+ * @param[out] cpus the requested cpu list
+ * @param[out] priority the requested SCHED_FIFO priority
+ * @param[out] applied the applied placement, empty if no thread of the role has started
+ */
+void Camera::getThreadPlacement(string role, string& cpus, int& priority, string& applied) {
+    DEB_MEMBER_FUNCT();
+    ThreadPlacement::Role r = ThreadPlacement::getRole(role);
+    m_placement.get(r, cpus, priority);
+    m_placement.getApplied(r, applied);
+}
+
+/**
+ * Give the cpu set of the hist or scope role to the sdk threads, the other roles are applied by
+ * the plugin threads themselves.
+ */
+void Camera::applySdkPlacement(ThreadPlacement::Role role) {
+    DEB_MEMBER_FUNCT();
+    cpu_set_t cpu_set;
+    if (!m_placement.getCpuSet(role, cpu_set)) {
+        return;
+    }
+    if (role == ThreadPlacement::Hist) {
+        for (int chan = 0; chan < m_nb_chans; chan++) {
+            if (xsp3_hist_cpu_set(m_handle, chan, &cpu_set) < 0) {
+                THROW_HW_ERROR(Error) << xsp3_get_error_message();
+            }
+            // moves a running receive thread, otherwise the cpu set is used when it starts
+            if (xsp3_hist_cpu_set_update(m_handle, chan) < 0) {
+                DEB_TRACE() << "channel " << chan << " receive thread not moved: " << xsp3_get_error_message();
+            }
+        }
+    } else if (role == ThreadPlacement::Scope) {
+        for (int card = 0; card < m_nb_cards; card++) {
+            if (xsp3_scope_cpu_set(m_handle, card, &cpu_set) < 0) {
+                THROW_HW_ERROR(Error) << xsp3_get_error_message();
+            }
+        }
+    } else {
+        return;
+    }
+    m_placement.setApplied(role, "cpus " + ThreadPlacement::formatCpus(cpu_set));
+}
+
+/**
+ * Group the system channels by card, with the sdk path and channel index of each card.
+ */
+void Camera::resolveCards() {
+    DEB_MEMBER_FUNCT();
+    m_cards.clear();
+    for (int chan = 0; chan < m_nb_chans; chan++) {
+        int path, chan_idx, card;
+        if (xsp3_resolve_path_chan_card(m_handle, chan, &path, &chan_idx, &card) < 0) {
+            THROW_HW_ERROR(Error) << xsp3_get_error_message();
+        }
+        if (m_cards.empty() || m_cards.back().card != card) {
+            CardInfo info;
+            info.card = card;
+            info.path = path;
+            info.chan_idx = chan_idx;
+            info.first_chan = chan;
+            info.nb_chans = 0;
+            m_cards.push_back(info);
+        }
+        m_cards.back().nb_chans++;
+    }
+    DEB_TRACE() << "resolved " << m_nb_chans << " channels on " << m_cards.size() << " cards";
+}
+
+void Camera::stopCardThreads() {
+    DEB_MEMBER_FUNCT();
+    for (size_t i = 0; i < m_card_threads.size(); i++) {
+        delete m_card_threads[i];
+    }
+    m_card_threads.clear();
+}
+
+/**
+ * Enable/disable the per card readout. When enabled the frames are read by one thread per card,
+ * each one reading the histograms and scalers of its own channels, so the readout time of a
+ * multi-box system no longer grows with the number of boxes.
+ *
+ * @param[in] flag enable or disable the per card readout
+ */
+void Camera::setCardReadout(bool flag) {
+    DEB_MEMBER_FUNCT();
+    waitInit();
+    DEB_PARAM() << DEB_VAR1(flag);
+    if (isAcqRunning()) {
+        THROW_HW_ERROR(Error) << "Cannot change the readout mode while acquiring";
+    }
+    stopCardThreads();
+    m_card_readout = false;
+    if (flag) {
+        resolveCards();
+        for (size_t i = 0; i < m_cards.size(); i++) {
+            m_card_threads.push_back(new CardReadThread(*this, i));
+            m_card_threads.back()->start();
+        }
+        m_card_readout = true;
+    }
+}
+
+void Camera::getCardReadout(bool& flag) {
+    DEB_MEMBER_FUNCT();
+    flag = m_card_readout;
+}
+
+/**
+ * Get the number of frames completed by each card, to spot a card lagging behind the others.
+ *
+ * @param[out] progress Data [nb_cards] int32, the frames completed per card
+ */
+void Camera::getCardProgress(Data& progress) {
+    DEB_MEMBER_FUNCT();
+    waitInit();
+    if (m_cards.empty()) {
+        resolveCards();
+    }
+    int n = m_cards.size();
+    progress.type = Data::INT32;
+    progress.frameNumber = 0;
+    progress.dimensions.push_back(n);
+    Buffer *buff = BufferPool::getInstance().getBuffer(n * sizeof(int32_t));
+    int32_t *pdata = (int32_t*)buff->data;
+    for (int i = 0; i < n; i++) {
+        Xsp3ErrFlag flags;
+        int64_t furthest_frame;
+        int64_t fn = xsp3_scaler_check_progress_details(m_cards[i].path, &flags, 1, &furthest_frame);
+        DEB_TRACE() << DEB_VAR4(m_cards[i].card, fn, flags, furthest_frame);
+        if (fn < 0) {
+            buff->unref();
+            THROW_HW_ERROR(Error) << xsp3_get_error_message();
+        }
+        pdata[i] = (fn > INT_MAX) ? INT_MAX : (int32_t)fn;
+    }
+    progress.setBuffer(buff);
+    buff->unref();
+}
+
+/**
+ * Dead time correct a frame in place (used by read thread only). The histogram bins and
+ * scalers of each channel are replaced by their float32 corrected values, in the same
+ * layout as {@link #readFrame()}.
+ *
+ * @param[in,out] fptr the Lima frame
+ */
+void Camera::correctFrame(void *fptr) {
+    DEB_MEMBER_FUNCT();
+    u_int32_t* bptr = (u_int32_t*)fptr;
+    int stride = m_npixels + m_nscalers;
+    m_dtc_factors.resize(m_nb_chans);
+    m_dtc_all_event.resize(m_nb_chans);
+    m_dtc_flags.resize(m_nb_chans);
+
+    calcDtcFactors(bptr + m_npixels, stride, 0, m_nb_chans, &m_dtc_factors[0], &m_dtc_all_event[0], &m_dtc_flags[0]);
+    for (int chan = 0; chan < m_nb_chans; chan++) {
+        correctChannel(bptr, m_dtc_factors[chan], m_dtc_all_event[chan], m_dtc_flags[chan]);
+        bptr += stride;
+    }
+}
+
+/**
+ * Dead time correct the histogram and scalers of one channel of a frame in place to float32.
+ *
+ * @param[in,out] bptr the channel in the Lima frame
+ * @param[in] factor the dead time correction factor
+ * @param[in] all_event the dead time corrected AllEvent
+ * @param[in] flags the dead time correction flags
+ */
+void Camera::correctChannel(u_int32_t* bptr, double factor, double all_event, int flags) {
+    int stride = m_npixels + m_nscalers;
+    float* dptr = (float*)bptr;
+    m_dtc_kernel.correctHistograms(bptr, stride, 1, m_npixels, &factor, dptr);
+    DtcKernel::correctScalers(bptr + m_npixels, stride, 1, m_nscalers, &factor, &all_event, &flags, dptr + m_npixels);
+}
+
+/**
+ * Save each acquisition to a NeXus/HDF5 file written by the plugin, in addition to any Lima saving.
+ * Raw frames (Bpp32) give the histogram and scaler datasets, plus the dead time corrected ones
+ * when setUseDtc is enabled. Corrected frames (Bpp32F) give the corrected datasets only.
+ *
+ * @param[in] filename the file, overwritten at each prepareAcq (empty to disable)
+ */
+void Camera::setHdfFile(string filename) {
+    DEB_MEMBER_FUNCT();
+    DEB_PARAM() << DEB_VAR1(filename);
+#ifdef WITH_HDF5_SAVING
+    m_hdf_file = filename;
+#else
+    if (!filename.empty()) {
+        THROW_HW_ERROR(NotSupported) << "Plugin built without WITH_HDF5_SAVING";
+    }
+#endif
+}
+
+void Camera::getHdfFile(string& filename) {
+    DEB_MEMBER_FUNCT();
+    filename = m_hdf_file;
+}
+
+/**
+ * Set the number of frames buffered before each HDF5 write, also the chunk size in frames.
+ *
+ * @param[in] nb_frames the number of frames per write
+ */
+void Camera::setHdfFramesPerWrite(int nb_frames) {
+    DEB_MEMBER_FUNCT();
+    DEB_PARAM() << DEB_VAR1(nb_frames);
+#ifdef WITH_HDF5_SAVING
+    if (m_hdf_writer == NULL) {
+        m_hdf_writer = new HdfWriter(&m_placement);
+    }
+    m_hdf_writer->setFramesPerWrite(nb_frames);
+#else
+    THROW_HW_ERROR(NotSupported) << "Plugin built without WITH_HDF5_SAVING";
+#endif
+}
+
+void Camera::getHdfFramesPerWrite(int& nb_frames) {
+    DEB_MEMBER_FUNCT();
+#ifdef WITH_HDF5_SAVING
+    if (m_hdf_writer == NULL) {
+        m_hdf_writer = new HdfWriter(&m_placement);
+    }
+    nb_frames = m_hdf_writer->getFramesPerWrite();
+#else
+    nb_frames = 0;
+#endif
+}
+
+/**
+ * Get the progress of the HDF5 file of the current or last acquisition.
+ *
+ * @param[out] nb_frames the number of frames written
+ * @param[out] frames_per_sec the average write rate
+ * @param[out] error the write error, empty if none
+ */
+void Camera::getHdfStatus(int& nb_frames, double& frames_per_sec, string& error) {
+    DEB_MEMBER_FUNCT();
+    nb_frames = 0;
+    frames_per_sec = 0.0;
+    error.clear();
+#ifdef WITH_HDF5_SAVING
+    if (m_hdf_writer != NULL) {
+        m_hdf_writer->getStatus(nb_frames, frames_per_sec, error);
+    }
+#endif
+}
+
+/**
+ * Get the number of data buffers returned by readScalers, readHistogram, readRawHistogram and
+ * getFanTemperatures that were reused from the pool (hits) or newly allocated (misses).
+ */
+void Camera::getBufferPoolStats(long long& hits, long long& misses) {
+    DEB_MEMBER_FUNCT();
+    BufferPool::getInstance().getStats(hits, misses);
+}
+
+void Camera::resetBufferPoolStats() {
+    DEB_MEMBER_FUNCT();
+    BufferPool::getInstance().resetStats();
+}
+
+/**
+ * Enable the register shadow (default): the run flags, scaler windows, good event thresholds, channel control
+ * and dead time correction parameters are read from the hardware once, then from the shadow, and writes of
+ * unchanged values are skipped. Disabling it also invalidates the shadow.
+ *
+ * @param[in] flag true to enable the register shadow
+ */
+void Camera::setRegisterCache(bool flag) {
+    DEB_MEMBER_FUNCT();
+    DEB_PARAM() << DEB_VAR1(flag);
+    AutoMutex aLock(m_reg_mutex);
+    m_reg_cache = flag;
+    aLock.unlock();
+    invalidateRegisterCache();
+}
+
+void Camera::getRegisterCache(bool& flag) {
+    DEB_MEMBER_FUNCT();
+    AutoMutex aLock(m_reg_mutex);
+    flag = m_reg_cache;
+}
+
+/**
+ * Invalidate the register shadow, each register is read again from the hardware the next time it is needed.
+ * To be called after the registers were changed by other means than this camera (e.g. another sdk client).
+ */
+void Camera::invalidateRegisterCache() {
+    DEB_MEMBER_FUNCT();
+    AutoMutex aLock(m_reg_mutex);
+    m_chan_regs.assign(m_nb_chans, ChanRegs());
+    m_run_flags_valid = false;
+}
+
+/**
+ * Reload the whole register shadow from the hardware.
+ */
+void Camera::resyncRegisterCache() {
+    DEB_MEMBER_FUNCT();
+    waitInit();
+    invalidateRegisterCache();
+    AutoMutex aLock(m_reg_mutex);
+    if (!m_reg_cache)
+        return;
+    aLock.unlock();
+    getRunFlags();
+    for (int chan = 0; chan < m_nb_chans; chan++) {
+        u_int32_t low, high, good_thres, chan_control;
+        int flags;
+        double params[4];
+        getWindow(chan, 0, low, high);
+        getWindow(chan, 1, low, high);
+        getGoodThreshold(chan, good_thres);
+        aLock.lock();
+        getChanCont(chan, chan_control);
+        aLock.unlock();
+        getDtcParams(chan, flags, params);
+    }
+}
+
+/**
+ * Get the register shadow statistics since the camera was created.
+ *
+ * @param[out] hits the number of register reads served from the shadow
+ * @param[out] misses the number of register reads from the hardware
+ * @param[out] skipped_writes the number of writes skipped as the registers already had the values
+ */
+void Camera::getRegisterCacheStats(long long& hits, long long& misses, long long& skipped_writes) {
+    DEB_MEMBER_FUNCT();
+    AutoMutex aLock(m_reg_mutex);
+    hits = m_reg_hits;
+    misses = m_reg_misses;
+    skipped_writes = m_reg_skipped;
+}
+
+/**
+ * Get the shadow of a channel, NULL if the shadow is disabled or chan is not a single channel.
+ * Called with m_reg_mutex locked.
+ */
+Camera::ChanRegs* Camera::getChanRegs(int chan) {
+    if (!m_reg_cache || chan < 0 || chan >= (int)m_chan_regs.size())
+        return NULL;
+    return &m_chan_regs[chan];
+}
+
+/**
+ * Get the range of shadows written by a setter, a negative chan selects all channels.
+ * Called with m_reg_mutex locked.
+ *
+ * @return false if the shadow is disabled or chan is out of range
+ */
+bool Camera::getCachedChans(int chan, int& first_chan, int& last_chan) {
+    if (!m_reg_cache || chan >= (int)m_chan_regs.size())
+        return false;
+    first_chan = chan < 0 ? 0 : chan;
+    last_chan = chan < 0 ? m_chan_regs.size() : chan + 1;
+    return true;
+}
+
+int Camera::getRunFlags() {
+    DEB_MEMBER_FUNCT();
+    AutoMutex aLock(m_reg_mutex);
+    if (m_reg_cache && m_run_flags_valid) {
+        m_reg_hits++;
+        return m_run_flags;
+    }
+    int flags;
+    if ((flags = xsp3_get_run_flags(m_handle)) < 0) {
+        THROW_HW_ERROR(Error) << xsp3_get_error_message();
+    }
+    m_reg_misses++;
+    m_run_flags = flags;
+    m_run_flags_valid = m_reg_cache;
+    return flags;
+}
+
+void Camera::setRunFlags(int flags) {
+    DEB_MEMBER_FUNCT();
+    AutoMutex aLock(m_reg_mutex);
+    if (m_reg_cache && m_run_flags_valid && m_run_flags == flags) {
+        m_reg_skipped++;
+        return;
+    }
+    int status = xsp3_set_run_flags(m_handle, flags);
+    m_run_flags = flags;
+    m_run_flags_valid = m_reg_cache && status >= 0;
+    if (status < 0) {
+        THROW_HW_ERROR(Error) << xsp3_get_error_message();
+    }
+}
+
+/**
+ * Get the channel control register of a channel. Called with m_reg_mutex locked.
+ */
+void Camera::getChanCont(int chan, u_int32_t& chan_control) {
+    DEB_MEMBER_FUNCT();
+    ChanRegs* regs = getChanRegs(chan);
+    if (regs != NULL && regs->chan_cont_valid) {
+        chan_control = regs->chan_cont;
+        m_reg_hits++;
+        return;
+    }
+    if (xsp3_get_chan_cont(m_handle, chan, &chan_control) < 0) {
+        THROW_HW_ERROR(Error) << xsp3_get_error_message();
+    }
+    m_reg_misses++;
+    if (regs != NULL) {
+        regs->chan_cont = chan_control;
+        regs->chan_cont_valid = true;
+    }
+}
+
+/**
+ * Get the dead time correction flags and the 4 parameters of a channel.
+ */
+void Camera::getDtcParams(int chan, int& flags, double* params) {
+    DEB_MEMBER_FUNCT();
+    AutoMutex aLock(m_reg_mutex);
+    ChanRegs* regs = getChanRegs(chan);
+    if (regs != NULL && regs->dtc_valid) {
+        flags = regs->dtc_flags;
+        for (int j = 0; j < 4; j++) {
+            params[j] = regs->dtc_params[j];
+        }
+        m_reg_hits++;
+        return;
+    }
+    if (xsp3_getDeadtimeCorrectionParameters(m_handle, chan, &flags, params, params + 1, params + 2, params + 3) < 0) {
+        THROW_HW_ERROR(Error) << xsp3_get_error_message();
+    }
+    m_reg_misses++;
+    if (regs != NULL) {
+        regs->dtc_flags = flags;
+        for (int j = 0; j < 4; j++) {
+            regs->dtc_params[j] = params[j];
+        }
+        regs->dtc_valid = true;
+    }
+}
+
+/**
+ * Pass frames read into the Lima buffers to the HDF5 writer (used by read thread only).
+ */
+void Camera::saveFrames(int first_frame, int nb_frames) {
+    DEB_MEMBER_FUNCT();
+#ifdef WITH_HDF5_SAVING
+    if (!m_hdf_writer->isOpen()) {
+        return;
+    }
+    StdBufferCbMgr& buffer_mgr = m_bufferCtrlObj.getBuffer();
+    int stride = m_npixels + m_nscalers;
+    bool dtc = m_use_dtc && m_image_type == Bpp32;
+    m_dtc_factors.resize(m_nb_chans);
+    m_dtc_all_event.resize(m_nb_chans);
+    m_dtc_flags.resize(m_nb_chans);
+    for (int i = 0; i < nb_frames; i++) {
+        u_int32_t* fptr = (u_int32_t*) buffer_mgr.getFrameBufferPtr(first_frame + i);
+        if (dtc) {
+            // the writer thread applies the correction
+            calcDtcFactors(fptr + m_npixels, stride, 0, m_nb_chans, &m_dtc_factors[0], &m_dtc_all_event[0], &m_dtc_flags[0]);
+        }
+        m_hdf_writer->addFrame(fptr, &m_dtc_factors[0], &m_dtc_all_event[0], &m_dtc_flags[0]);
+    }
+#endif
+}
+
+void Camera::closeHdfFile() {
+    DEB_MEMBER_FUNCT();
+#ifdef WITH_HDF5_SAVING
+    if (m_hdf_writer != NULL) {
+        m_hdf_writer->close();
+    }
+#endif
+}
+
+/**
+ * Set the maximum number of frames read from the hardware in one go by the read thread.
+ * A batch is also limited to one frame less than the number of Lima buffers.
+ *
+ * @param[in] nb_frames the batch size, 1 reads frame by frame
+ */
+void Camera::setReadBatchSize(int nb_frames) {
     DEB_MEMBER_FUNCT();
-    u_int32_t scalerData[m_nscalers*m_nb_chans];
-    u_int32_t* bptr = (u_int32_t*)fptr;
-
-    DEB_TRACE() << "Camera::readFrame() scalers " << DEB_VAR2(frame_nb, m_nb_chans);
-    if (xsp3_scaler_read(m_handle, scalerData, 0, 0, frame_nb, m_nscalers, m_nb_chans, 1) < 0) {
-        THROW_HW_ERROR(Error) << xsp3_get_error_message();
-    }
-    for (int chan=0; chan<m_nb_chans; chan++) {
-        DEB_TRACE() << "Camera::readFrame() histogram " << DEB_VAR3(frame_nb, m_npixels, chan);
-        if (xsp3_histogram_read3d(m_handle, (u_int32_t*) bptr, 0, chan, frame_nb, m_npixels, 1, 1) < 0) {
-            THROW_HW_ERROR(Error) << xsp3_get_error_message();
-        }
-        bptr += m_npixels;
-        for (int i=0; i<m_nscalers; i++) {
-            *bptr++ = scalerData[chan*m_nscalers+i];
-        }
+    DEB_PARAM() << DEB_VAR1(nb_frames);
+    if (nb_frames < 1) {
+        THROW_HW_ERROR(InvalidValue) << "Read batch size must be at least 1";
     }
+    AutoMutex aLock(m_cond.mutex());
+    m_read_batch_size = nb_frames;
+}
+
+void Camera::getReadBatchSize(int& nb_frames) {
+    DEB_MEMBER_FUNCT();
+    nb_frames = m_read_batch_size;
 }
 
 /**
@@ -1194,6 +3490,7 @@ void Camera::readFrame(void *fptr, int frame_nb) {
  */
 void Camera::readScalers(Data& scalerData, int frame_nb, int channel) {
     DEB_MEMBER_FUNCT();
+    waitInit();
     HwFrameInfo frame_info;
     if (frame_nb >= m_read_frame_nb) {
         THROW_HW_ERROR(Error) << "Frame not available yet";
@@ -1204,67 +3501,185 @@ void Camera::readScalers(Data& scalerData, int frame_nb, int channel) {
         scalerData.dimensions.push_back(1);
         scalerData.frameNumber = frame_nb;
 
-        Buffer *fbuf = new Buffer();
+        Buffer *fbuf = BufferPool::getInstance().getBuffer((m_nscalers+2) * sizeof(double));
         u_int32_t *fptr = (u_int32_t*)frame_info.frame_ptr;
         fptr += channel * (m_npixels + m_nscalers) + m_npixels;
-        ///DEB_TRACE() << DEB_VAR1(m_use_dtc);
 
         scalerData.type = Data::DOUBLE;
-        double *buff = new double[m_nscalers+2];
-        double *bptr = buff;
+        double *buff = (double*)fbuf->data;
 
-        if (m_use_dtc) {
+        Xspress3_TriggerB trig_b;
+        xsp3_get_trigger_b(m_handle, channel, &trig_b);
+        if (m_use_dtc && m_image_type != Bpp32F) {
             double dtcFactor;
-            correctScalerData(buff, fptr, channel, dtcFactor);
+            double dtcAllEvent;
+            int flags;
+            calcDtcFactors(fptr, m_nscalers, channel, 1, &dtcFactor, &dtcAllEvent, &flags);
+            getScalerValues(buff, fptr, trig_b.event_time, &dtcFactor, &dtcAllEvent, &flags);
         } else {
-            for (int i = 0; i < m_nscalers; i++) {
-                *bptr++ = (double)*fptr++;
-            }
+            getScalerValues(buff, fptr, trig_b.event_time, NULL, NULL, NULL);
         }
 
+        scalerData.setBuffer(fbuf);
+        fbuf->unref();
+    }
+}
+
+/**
+ * Read a range of frames of scaler data for a set of channels in one block of
+ * nb_frames x channels x (scalers + 2) values, in the format of {@link #readScalers()}.
+ *
+ * @param[out] scalerData a data buffer to receive scaler data
+ * @param[in] first_frame the first time frame to read
+ * @param[in] nb_frames the number of time frames to read
+ * @param[in] chan_mask the channels to read, bit n for channel n (-1 for all channels)
+ */
+void Camera::readScalerFrames(Data& scalerData, int first_frame, int nb_frames, long long chan_mask) {
+    DEB_MEMBER_FUNCT();
+    waitInit();
+    DEB_PARAM() << DEB_VAR3(first_frame, nb_frames, chan_mask);
+    vector<int> chans;
+    checkFrameRange(first_frame, nb_frames, chan_mask, chans);
+    int nb_sel = chans.size();
+    int first_chan = chans.front();
+    int nb_span = chans.back() - first_chan + 1;
+    int stride = m_npixels + m_nscalers;
+
+    scalerData.type = Data::DOUBLE;
+    scalerData.dimensions.push_back(m_nscalers+2);
+    scalerData.dimensions.push_back(nb_sel);
+    scalerData.dimensions.push_back(nb_frames);
+    scalerData.frameNumber = first_frame;
+
+    vector<double> evtwidth(nb_sel);
+    for (int i = 0; i < nb_sel; i++) {
         Xspress3_TriggerB trig_b;
-        xsp3_get_trigger_b(m_handle, channel, &trig_b);
-        double evtwidth = (double)trig_b.event_time;
-        double resets = buff[1];
-        double allevt = buff[3];
-        double ctime = buff[0];
+        xsp3_get_trigger_b(m_handle, chans[i], &trig_b);
+        evtwidth[i] = trig_b.event_time;
+    }
+    bool dtc = m_use_dtc && m_image_type != Bpp32F;
+    vector<double> factors(nb_span), all_event(nb_span);
+    vector<int> flags(nb_span);
+
+    StdBufferCbMgr& buffer_mgr = m_bufferCtrlObj.getBuffer();
+    Buffer *fbuf = BufferPool::getInstance().getBuffer((size_t)nb_frames * nb_sel * (m_nscalers+2) * sizeof(double));
+    double *buff = (double*)fbuf->data;
+    double *bptr = buff;
+    for (int frame = 0; frame < nb_frames; frame++) {
+        HwFrameInfo frame_info;
+        buffer_mgr.getFrameInfo(first_frame + frame, frame_info);
+        u_int32_t *fptr = (u_int32_t*)frame_info.frame_ptr + m_npixels;
+        if (dtc) {
+            // one sdk call for all the channels of the frame
+            calcDtcFactors(fptr + first_chan * stride, stride, first_chan, nb_span, &factors[0], &all_event[0], &flags[0]);
+        }
+        for (int i = 0; i < nb_sel; i++) {
+            int k = chans[i] - first_chan;
+            if (dtc) {
+                getScalerValues(bptr, fptr + chans[i] * stride, evtwidth[i], &factors[k], &all_event[k], &flags[k]);
+            } else {
+                getScalerValues(bptr, fptr + chans[i] * stride, evtwidth[i], NULL, NULL, NULL);
+            }
+            bptr += m_nscalers+2;
+        }
+    }
+    scalerData.setBuffer(fbuf);
+    fbuf->unref();
+}
 
-        ////DEB_TRACE() << DEB_VAR4(evtwidth, resets, allevt, ctime);
+/**
+ * Convert the scalers of one channel of a Lima frame to double and append the dead time %
+ * and the dead time correction factor.
+ *
+ * @param[out] dst m_nscalers + 2 values
+ * @param[in] sptr the scalers of the channel in the Lima frame
+ * @param[in] evtwidth the event width of the channel
+ * @param[in] dtc_factor the dead time correction factor, NULL for no correction
+ * @param[in] dtc_all_event the estimated input count
+ * @param[in] dtc_flags the dead time correction flags
+ */
+void Camera::getScalerValues(double* dst, u_int32_t* sptr, double evtwidth, const double* dtc_factor,
+        const double* dtc_all_event, const int* dtc_flags) {
+    if (m_image_type == Bpp32F) {
+        // already corrected by the read thread
+        float *cptr = (float*)sptr;
+        for (int i = 0; i < m_nscalers; i++) {
+            dst[i] = (double)cptr[i];
+        }
+    } else if (dtc_factor != NULL) {
+        DtcKernel::correctScalers(sptr, m_nscalers, 1, m_nscalers, dtc_factor, dtc_all_event, dtc_flags, dst);
+    } else {
+        for (int i = 0; i < m_nscalers; i++) {
+            dst[i] = (double)sptr[i];
+        }
+    }
+    double resets = dst[1];
+    double allevt = dst[3];
+    double ctime = dst[0];
 
-        *bptr++ = 100.0*(allevt*(evtwidth+1) + resets)/ctime;
-        *bptr++ = ctime/(ctime - (allevt*(evtwidth+1) + resets));
+    dst[m_nscalers] = 100.0*(allevt*(evtwidth+1) + resets)/ctime;
+    dst[m_nscalers+1] = ctime/(ctime - (allevt*(evtwidth+1) + resets));
+}
 
-        fbuf->data = buff;
-        scalerData.setBuffer(fbuf);
-        fbuf->unref();
+/**
+ * Check a range of frames is available in the Lima buffers and get the channels of a mask.
+ */
+void Camera::checkFrameRange(int first_frame, int nb_frames, long long chan_mask, vector<int>& chans) {
+    DEB_MEMBER_FUNCT();
+    if (first_frame < 0 || nb_frames < 1) {
+        THROW_HW_ERROR(InvalidValue) << "Invalid frame range " << DEB_VAR2(first_frame, nb_frames);
+    }
+    if (first_frame + nb_frames > m_read_frame_nb) {
+        THROW_HW_ERROR(Error) << "Frame not available yet";
+    }
+    for (int chan = 0; chan < m_nb_chans && chan < 64; chan++) {
+        if (chan_mask & (1LL << chan)) {
+            chans.push_back(chan);
+        }
+    }
+    if (chans.empty()) {
+        THROW_HW_ERROR(InvalidValue) << "No channel selected " << DEB_VAR2(chan_mask, m_nb_chans);
     }
 }
 
 void Camera::correctScalerData(double* buff, u_int32_t* fptr, int channel, double& dtcFactor) {
     DEB_MEMBER_FUNCT();
-    double *dptr = buff;
-    //  double dtcFactor;
     double dtcAllEvent;
-    int flags = 0;
+    int flags;
 
-    if (xsp3_calculateDeadtimeCorrectionFactors(m_handle, fptr, &dtcFactor, &dtcAllEvent, 1, channel, 1) < 0) {
-//  if (xsp3_calculateDeadtimeCorrectionFactors(m_handle, fptr, &dtcFactor, &dtcAllEvent, 1, 1) < 0) {
-        THROW_HW_ERROR(Error) << xsp3_get_error_message();
-    }
+    calcDtcFactors(fptr, m_nscalers, channel, 1, &dtcFactor, &dtcAllEvent, &flags);
     DEB_TRACE() << "Calculated dead time correction factor " << dtcFactor << " dtc allevent " << dtcAllEvent;
-    xsp3_getDeadtimeCorrectionFlags(m_handle, channel, &flags);
-    for (int k = 0; k < m_nscalers; k++) {
-        if (k == XSP3_SCALER_INWINDOW0 || k == XSP3_SCALER_INWINDOW1) {
-            *dptr++ = (double) *fptr++ * dtcFactor;
-        } else if (k == XSP3_SCALER_ALLEVENT && !(flags & XSP3_DTC_USE_GOOD_EVENT)) {
-            *dptr++ = dtcAllEvent;
-            fptr++;
-        } else if (k == XSP3_SCALER_ALLGOOD && (flags & XSP3_DTC_USE_GOOD_EVENT)) {
-            *dptr++ = dtcAllEvent;
-            fptr++;
-        } else {
-            *dptr++ = (double) *fptr++;
+    DtcKernel::correctScalers(fptr, m_nscalers, 1, m_nscalers, &dtcFactor, &dtcAllEvent, &flags, buff);
+}
+
+/**
+ * Calculate the dead time correction factors of consecutive channels in one sdk call.
+ *
+ * @param[in] scalers the scalers of the first channel
+ * @param[in] stride the distance between two channels (npixels + nscalers in a Lima frame)
+ * @param[in] first_chan the first channel
+ * @param[in] nb_chans the number of channels
+ * @param[out] factors the dead time correction factor per channel
+ * @param[out] all_event the estimated input count per channel
+ * @param[out] flags the dead time correction flags per channel
+ */
+void Camera::calcDtcFactors(u_int32_t* scalers, int stride, int first_chan, int nb_chans, double* factors, double* all_event, int* flags) {
+    DEB_MEMBER_FUNCT();
+    vector<u_int32_t> buff;
+    if (nb_chans > 1 && stride != m_nscalers) {
+        // the sdk expects the scalers of the channels to be contiguous
+        buff.resize(nb_chans * m_nscalers);
+        for (int chan = 0; chan < nb_chans; chan++) {
+            memcpy(&buff[chan * m_nscalers], scalers + chan * stride, m_nscalers * sizeof(u_int32_t));
         }
+        scalers = &buff[0];
+    }
+    if (xsp3_calculateDeadtimeCorrectionFactors(m_handle, scalers, factors, all_event, 1, first_chan, nb_chans) < 0) {
+        THROW_HW_ERROR(Error) << xsp3_get_error_message();
+    }
+    for (int chan = 0; chan < nb_chans; chan++) {
+        flags[chan] = 0;
+        xsp3_getDeadtimeCorrectionFlags(m_handle, first_chan + chan, &flags[chan]);
     }
 }
 
@@ -1284,43 +3699,124 @@ void Camera::readHistogram(Data& histData, int frame_nb, int channel) {
         StdBufferCbMgr& buffer_mgr = m_bufferCtrlObj.getBuffer();
         buffer_mgr.getFrameInfo(frame_nb, frame_info);
 
-        histData.type = Data::UINT32;
+        histData.type = getHistType();
         histData.dimensions.push_back(m_npixels);
         histData.dimensions.push_back(1);
         histData.frameNumber = frame_nb;
 
-        Buffer *fbuf = new Buffer();
+        Buffer *fbuf = BufferPool::getInstance().getBuffer(m_npixels * getHistTypeSize(histData.type));
         u_int32_t *fptr = (u_int32_t*) frame_info.frame_ptr;
         fptr += channel * (m_npixels + m_nscalers);
-        u_int32_t *scalerData = (u_int32_t*) frame_info.frame_ptr;
-        scalerData += channel * (m_npixels + m_nscalers) + m_npixels;
-        if (m_use_dtc) {
-            double *buff = new double[m_npixels];
-            double *dptr = buff;
+        void *buff = fbuf->data;
+        if (m_use_dtc && m_image_type != Bpp32F) {
             double dtcFactor;
             double dtcAllEvent;
-            if (xsp3_calculateDeadtimeCorrectionFactors(m_handle, scalerData, &dtcFactor, &dtcAllEvent, 1, channel, 1) < 0) {
-                THROW_HW_ERROR(Error) << xsp3_get_error_message();
-            }
-            histData.type = Data::DOUBLE;
-            for (int i = 0; i < m_npixels; i++) {
-                *dptr++ = (double) *fptr++ * dtcFactor;
-            }
-            fbuf->data = buff;
+            int flags;
+            calcDtcFactors(fptr + m_npixels, m_npixels + m_nscalers, channel, 1, &dtcFactor, &dtcAllEvent, &flags);
+            getHistValues(buff, histData.type, fptr, &dtcFactor);
         } else {
-            u_int32_t *buff = new u_int32_t[m_npixels];
-            u_int32_t *bptr = buff;
-            histData.type = Data::UINT32;
-            for (int i = 0; i < m_npixels; i++) {
-                *bptr++ = *fptr++;
-            }
-            fbuf->data = buff;
+            getHistValues(buff, histData.type, fptr, NULL);
         }
         histData.setBuffer(fbuf);
         fbuf->unref();
     }
 }
 
+/**
+ * Read a range of frames of histogram data for a set of channels in one block of
+ * nb_frames x channels x bins values, in the format of {@link #readHistogram()}.
+ *
+ * @param[out] histData a data buffer to receive histogram data
+ * @param[in] first_frame the first time frame to read
+ * @param[in] nb_frames the number of time frames to read
+ * @param[in] chan_mask the channels to read, bit n for channel n (-1 for all channels)
+ */
+void Camera::readHistogramFrames(Data& histData, int first_frame, int nb_frames, long long chan_mask) {
+    DEB_MEMBER_FUNCT();
+    DEB_PARAM() << DEB_VAR3(first_frame, nb_frames, chan_mask);
+    vector<int> chans;
+    checkFrameRange(first_frame, nb_frames, chan_mask, chans);
+    int nb_sel = chans.size();
+    int first_chan = chans.front();
+    int nb_span = chans.back() - first_chan + 1;
+    int stride = m_npixels + m_nscalers;
+
+    histData.type = getHistType();
+    histData.dimensions.push_back(m_npixels);
+    histData.dimensions.push_back(nb_sel);
+    histData.dimensions.push_back(nb_frames);
+    histData.frameNumber = first_frame;
+
+    bool dtc = m_use_dtc && m_image_type != Bpp32F;
+    vector<double> factors(nb_span), all_event(nb_span);
+    vector<int> flags(nb_span);
+    int size = getHistTypeSize(histData.type);
+
+    StdBufferCbMgr& buffer_mgr = m_bufferCtrlObj.getBuffer();
+    Buffer *fbuf = BufferPool::getInstance().getBuffer((size_t)nb_frames * nb_sel * m_npixels * size);
+    char *bptr = (char*)fbuf->data;
+    for (int frame = 0; frame < nb_frames; frame++) {
+        HwFrameInfo frame_info;
+        buffer_mgr.getFrameInfo(first_frame + frame, frame_info);
+        u_int32_t *fptr = (u_int32_t*)frame_info.frame_ptr;
+        if (dtc) {
+            // one sdk call for all the channels of the frame
+            calcDtcFactors(fptr + first_chan * stride + m_npixels, stride, first_chan, nb_span, &factors[0], &all_event[0], &flags[0]);
+        }
+        for (int i = 0; i < nb_sel; i++) {
+            getHistValues(bptr, histData.type, fptr + chans[i] * stride, dtc ? &factors[chans[i] - first_chan] : NULL);
+            bptr += (size_t)m_npixels * size;
+        }
+    }
+    histData.setBuffer(fbuf);
+    fbuf->unref();
+}
+
+/**
+ * Get the data type returned by readHistogram(), DOUBLE or FLOAT when dead time corrected.
+ */
+Data::TYPE Camera::getHistType() {
+    if (m_use_dtc || m_image_type == Bpp32F) {
+        return m_dtc_float ? Data::FLOAT : Data::DOUBLE;
+    }
+    return Data::UINT32;
+}
+
+int Camera::getHistTypeSize(Data::TYPE type) {
+    return (type == Data::DOUBLE) ? sizeof(double) : sizeof(u_int32_t);
+}
+
+/**
+ * Copy the histogram of one channel of a Lima frame, dead time corrected if dtc_factor is not NULL.
+ *
+ * @param[out] dst m_npixels values of type
+ * @param[in] type UINT32, FLOAT or DOUBLE
+ * @param[in] hptr the histogram of the channel in the Lima frame
+ * @param[in] dtc_factor the dead time correction factor, NULL for no correction
+ */
+void Camera::getHistValues(void* dst, Data::TYPE type, u_int32_t* hptr, const double* dtc_factor) {
+    if (m_image_type == Bpp32F) {
+        // already corrected by the read thread
+        float *cptr = (float*)hptr;
+        if (type == Data::FLOAT) {
+            memcpy(dst, cptr, m_npixels * sizeof(float));
+        } else {
+            double *dptr = (double*)dst;
+            for (int i = 0; i < m_npixels; i++) {
+                dptr[i] = (double)cptr[i];
+            }
+        }
+    } else if (dtc_factor != NULL) {
+        if (type == Data::FLOAT) {
+            m_dtc_kernel.correctHistograms(hptr, m_npixels + m_nscalers, 1, m_npixels, dtc_factor, (float*)dst);
+        } else {
+            m_dtc_kernel.correctHistograms(hptr, m_npixels + m_nscalers, 1, m_npixels, dtc_factor, (double*)dst);
+        }
+    } else {
+        memcpy(dst, hptr, m_npixels * sizeof(u_int32_t));
+    }
+}
+
 /**
  * Read a frame of raw histogram data for a particular channel.
  *
@@ -1330,6 +3826,7 @@ void Camera::readHistogram(Data& histData, int frame_nb, int channel) {
  */
 void Camera::readRawHistogram(Data& histData, int frame_nb, int channel) {
     DEB_MEMBER_FUNCT();
+    waitInit();
     HwFrameInfo frame_info;
 
     histData.type = Data::UINT32;
@@ -1337,24 +3834,23 @@ void Camera::readRawHistogram(Data& histData, int frame_nb, int channel) {
     histData.dimensions.push_back(1);
     histData.frameNumber = frame_nb;
 
-    Buffer *fbuf = new Buffer();
-
-    u_int32_t *buff = new u_int32_t[m_npixels];
-    u_int32_t *bptr = buff;
+    Buffer *fbuf = BufferPool::getInstance().getBuffer(m_npixels * sizeof(u_int32_t));
+    u_int32_t *bptr = (u_int32_t*)fbuf->data;
 
     DEB_TRACE() << "Camera::readRawHistogram " << DEB_VAR3(frame_nb, m_npixels, channel);
     if (xsp3_histogram_read3d(m_handle, (u_int32_t*) bptr, 0, channel, frame_nb,
             m_npixels, 1, 1) < 0) {
+        fbuf->unref();
         THROW_HW_ERROR(Error) << xsp3_get_error_message();
     }
 
-    fbuf->data = buff;
     histData.setBuffer(fbuf);
     fbuf->unref();
 }
 
 void Camera::setAdcTempLimit(int temp) {
     DEB_MEMBER_FUNCT();
+    waitInit();
     if (xsp3_i2c_set_adc_temp_limit(m_handle, m_card, temp) < 0) {
         THROW_HW_ERROR(Error) << xsp3_get_error_message();
     }
@@ -1362,23 +3858,19 @@ void Camera::setAdcTempLimit(int temp) {
 
 void Camera::setPlayback(bool enable) {
     DEB_MEMBER_FUNCT();
-    int flags;
-
-    if ((flags = xsp3_get_run_flags(m_handle)) < 0) {
-        THROW_HW_ERROR(Error) << xsp3_get_error_message();
-    }
+    waitInit();
+    int flags = getRunFlags();
     if (enable) {
         flags |= XSP3_RUN_FLAGS_PLAYBACK;
     } else {
         flags &= ~XSP3_RUN_FLAGS_PLAYBACK;
     }
-    if (xsp3_set_run_flags(m_handle, flags) < 0) {
-        THROW_HW_ERROR(Error) << xsp3_get_error_message();
-    }
+    setRunFlags(flags);
 }
 
 void Camera::loadPlayback(string filename, int src0, int src1, int streams, int digital) {
     DEB_MEMBER_FUNCT();
+    waitInit();
     DEB_TRACE() << "Camera::loadPlayback() " << DEB_VAR5(filename,src0,src1,streams,digital);
     int src[16];
     int str0dig;
@@ -1409,6 +3901,7 @@ void Camera::loadPlayback(string filename, int src0, int src1, int streams, int
 
 void Camera::startScope() {
     DEB_MEMBER_FUNCT();
+    waitInit();
     bool count_enb = true;
     int pb_num_t = 0;
     int scope_num_t = 0;
@@ -1450,12 +3943,15 @@ void Camera::startScope() {
  */
 void Camera::setTiming(int time_src, int first_frame, int alt_ttl_mode, int debounce, bool loop_io, bool f0_invert, bool veto_invert) {
     DEB_MEMBER_FUNCT();
+    waitInit();
     int t_src=0;
     u_int32_t time_fixed=0;
     u_int32_t time_a=0;
     int debounce_val;
     int alt_ttl;
     DEB_TRACE() << "Camera::setTiming() " << DEB_VAR7(time_src,first_frame,alt_ttl_mode,debounce,loop_io,f0_invert,veto_invert);
+    // the registers no longer match the staged timing
+    m_timing_valid = false;
 
     switch (time_src)
     {
@@ -1520,9 +4016,11 @@ void Camera::setTiming(int time_src, int first_frame, int alt_ttl_mode, int debo
     time_fixed = (first_frame < 0) ? 0 : first_frame;
     DEB_TRACE() << "first time frame " << time_fixed;
 
+    m_timing_writes++;
     if (xsp3_set_glob_timeA(m_handle, m_card, time_a) < 0) {
         THROW_HW_ERROR(Error) << xsp3_get_error_message();
     }
+    m_timing_writes++;
     if (xsp3_set_glob_timeFixed(m_handle, m_card, time_fixed) < 0) {
         THROW_HW_ERROR(Error) << xsp3_get_error_message();
     }
@@ -1555,6 +4053,7 @@ void Camera::setTiming(int time_src, int first_frame, int alt_ttl_mode, int debo
  */
 void Camera::formatRun(int chan, int nbits_eng, int aux1_mode, int adc_bits, int min_samples, int aux2_mode, bool pileup_reject) {
     DEB_MEMBER_FUNCT();
+    waitInit();
     int adc = 0;
     u_int32_t disables = 0;
     int aux2 = 0;
@@ -1622,10 +4121,11 @@ void Camera::formatRun(int chan, int nbits_eng, int aux1_mode, int adc_bits, int
  */
 void Camera::getDataSource(int chan, DataSrc& data_src) {
     DEB_MEMBER_FUNCT();
+    waitInit();
     u_int32_t chan_control;
-    if (xsp3_get_chan_cont(m_handle, chan, &chan_control) < 0) {
-        THROW_HW_ERROR(Error) << xsp3_get_error_message();
-    }
+    AutoMutex aLock(m_reg_mutex);
+    getChanCont(chan, chan_control);
+    aLock.unlock();
     switch (chan_control & 0x7) {
         case Camera::Normal:
             data_src = Normal;
@@ -1655,6 +4155,7 @@ void Camera::getDataSource(int chan, DataSrc& data_src) {
  */
 void Camera::setDataSource(int chan, DataSrc data_src) {
     DEB_MEMBER_FUNCT();
+    waitInit();
     u_int32_t chan_control;
     int startChan;
     int numChan;
@@ -1667,18 +4168,350 @@ void Camera::setDataSource(int chan, DataSrc data_src) {
         startChan = chan;
         numChan = chan+1;
     }
+    AutoMutex aLock(m_reg_mutex);
     for (i = startChan; i < numChan; i++) {
-        if (xsp3_get_chan_cont(m_handle, i, &chan_control) < 0) {
-            THROW_HW_ERROR(Error) << xsp3_get_error_message();
+        getChanCont(i, chan_control);
+        u_int32_t new_control = (chan_control & ~0x7) | data_src;
+        ChanRegs* regs = getChanRegs(i);
+        if (regs != NULL && new_control == chan_control) {
+            m_reg_skipped++;
+            continue;
+        }
+        int status = xsp3_set_chan_cont(m_handle, i, new_control);
+        if (regs != NULL) {
+            regs->chan_cont = new_control;
+            regs->chan_cont_valid = status >= 0;
         }
-        chan_control &= ~0x7;
-        chan_control |= data_src;
-        if (xsp3_set_chan_cont(m_handle, i, chan_control) < 0) {
+        if (status < 0) {
             THROW_HW_ERROR(Error) << xsp3_get_error_message();
         }
     }
 }
 
+/**
+ * Get the number of values of a bulk setter argument.
+ */
+static int getDataCount(const Data& data) {
+    if (data.dimensions.empty())
+        return 0;
+    int count = 1;
+    for (size_t i = 0; i < data.dimensions.size(); i++) {
+        count *= data.dimensions[i];
+    }
+    return count;
+}
+
+/**
+ * Get a value of a bulk setter argument, whatever its numeric type.
+ */
+static double getDataValue(Data& data, int idx) {
+    void* ptr = data.data();
+    switch (data.type) {
+        case Data::UINT8: return ((u_int8_t*)ptr)[idx];
+        case Data::INT8: return ((int8_t*)ptr)[idx];
+        case Data::UINT16: return ((u_int16_t*)ptr)[idx];
+        case Data::INT16: return ((int16_t*)ptr)[idx];
+        case Data::UINT32: return ((u_int32_t*)ptr)[idx];
+        case Data::INT32: return ((int32_t*)ptr)[idx];
+        case Data::UINT64: return ((u_int64_t*)ptr)[idx];
+        case Data::INT64: return ((int64_t*)ptr)[idx];
+        case Data::FLOAT: return ((float*)ptr)[idx];
+        case Data::DOUBLE: return ((double*)ptr)[idx];
+        default: return 0.0;
+    }
+}
+
+/**
+ * Allocate the result of a bulk getter, [nb_chans][nb_values] or [nb_chans] for a single value.
+ */
+static void* initBulkData(Data& data, Data::TYPE type, int type_size, int nb_chans, int nb_values) {
+    data.type = type;
+    data.frameNumber = 0;
+    data.dimensions.clear();
+    if (nb_values > 1)
+        data.dimensions.push_back(nb_values);
+    data.dimensions.push_back(nb_chans);
+    Buffer *buff = BufferPool::getInstance().getBuffer(nb_chans * nb_values * type_size);
+    data.setBuffer(buff);
+    buff->unref();
+    return data.data();
+}
+
+/**
+ * Get the values of a bulk setter argument, nb_values per channel for every channel of the system.
+ */
+void Camera::getBulkValues(Data& data, int nb_values, const char* name, vector<double>& values) {
+    DEB_MEMBER_FUNCT();
+    int count = getDataCount(data);
+    if (data.type == Data::UNDEF || data.data() == NULL || count != m_nb_chans * nb_values) {
+        THROW_HW_ERROR(InvalidValue) << "Invalid " << name << ", expected " << m_nb_chans << " channels x "
+                                     << nb_values << " values, got " << count << " values";
+    }
+    values.resize(count);
+    for (int i = 0; i < count; i++) {
+        values[i] = getDataValue(data, i);
+    }
+}
+
+/**
+ * Apply per channel values, grouped per card. When every channel has the same values they are written with a single
+ * all channels call. Otherwise a failing channel does not stop the others, the errors of all the channels are
+ * reported by one exception.
+ *
+ * @param[in] param the setting
+ * @param[in] values nb_values per channel for every channel of the system
+ * @param[out] nbins the number of bins per channel (BulkRoi only)
+ */
+void Camera::applyBulk(BulkParam param, const vector<double>& values, int nb_values, vector<int>& nbins) {
+    DEB_MEMBER_FUNCT();
+    nbins.assign(m_nb_chans, 0);
+    bool uniform = true;
+    for (int i = nb_values; i < m_nb_chans * nb_values && uniform; i++) {
+        uniform = values[i] == values[i % nb_values];
+    }
+    if (uniform) {
+        int n;
+        applyBulkChannel(param, -1, &values[0], nb_values, n);
+        nbins.assign(m_nb_chans, n);
+        return;
+    }
+    if (m_cards.empty()) {
+        resolveCards();
+    }
+    ostringstream errors;
+    int nb_errors = 0;
+    for (size_t card = 0; card < m_cards.size(); card++) {
+        CardInfo& info = m_cards[card];
+        for (int chan = info.first_chan; chan < info.first_chan + info.nb_chans; chan++) {
+            try {
+                applyBulkChannel(param, chan, &values[chan * nb_values], nb_values, nbins[chan]);
+            } catch (Exception& e) {
+                errors << "; card " << info.card << " channel " << chan << ": " << e.getErrMsg();
+                nb_errors++;
+            }
+        }
+    }
+    if (nb_errors > 0) {
+        THROW_HW_ERROR(Error) << nb_errors << " of " << m_nb_chans << " channels failed" << errors.str();
+    }
+}
+
+void Camera::applyBulkChannel(BulkParam param, int chan, const double* v, int nb_values, int& nbins) {
+    DEB_MEMBER_FUNCT();
+    switch (param) {
+        case BulkWindow0:
+        case BulkWindow1:
+            setWindow(chan, param - BulkWindow0, (int)v[0], (int)v[1]);
+            break;
+        case BulkGoodThres:
+            setGoodThreshold(chan, (int)v[0]);
+            break;
+        case BulkScaling:
+            setScaling(chan, v[0]);
+            break;
+        case BulkDataSrc:
+            setDataSource(chan, (DataSrc)(int)v[0]);
+            break;
+        case BulkDtc:
+            setDeadtimeCorrectionParameters(chan, v[0], v[1], v[2], v[3], v[4] != 0.0, v[5] != 0.0);
+            break;
+        case BulkRoi: {
+            Xsp3Roi roi(nb_values / 3);
+            for (int i = 0; i < nb_values / 3; i++) {
+                roi.addRegion(i, (int)v[i * 3], (int)v[i * 3 + 1], (int)v[i * 3 + 2]);
+            }
+            setRoi(chan, roi, nbins);
+            break;
+        }
+    }
+}
+
+/**
+ * Set the scaler windows of every channel.
+ *
+ * @param[in] win the window scaler (0 or 1)
+ * @param[in] low the low window thresholds [nb_chans] (0 ... 65535)
+ * @param[in] high the high window thresholds [nb_chans] (0 ... 65535)
+ */
+void Camera::setWindows(int win, Data& low, Data& high) {
+    DEB_MEMBER_FUNCT();
+    if (win != 0 && win != 1) {
+        THROW_HW_ERROR(InvalidValue) << "Invalid window " << win << ", should be 0 or 1";
+    }
+    vector<double> lows, highs, values(m_nb_chans * 2);
+    getBulkValues(low, 1, "low window thresholds", lows);
+    getBulkValues(high, 1, "high window thresholds", highs);
+    for (int chan = 0; chan < m_nb_chans; chan++) {
+        if (lows[chan] < 0 || lows[chan] > 65535 || highs[chan] < 0 || highs[chan] > 65535) {
+            THROW_HW_ERROR(InvalidValue) << "Invalid window thresholds " << lows[chan] << ", " << highs[chan]
+                                         << " on channel " << chan << ", should be 0 to 65535";
+        }
+        values[chan * 2] = lows[chan];
+        values[chan * 2 + 1] = highs[chan];
+    }
+    vector<int> nbins;
+    applyBulk(win == 0 ? BulkWindow0 : BulkWindow1, values, 2, nbins);
+}
+
+/**
+ * Get the scaler windows of every channel.
+ *
+ * @param[in] win the window (0 or 1)
+ * @param[out] low the low window thresholds [nb_chans]
+ * @param[out] high the high window thresholds [nb_chans]
+ */
+void Camera::getWindows(int win, Data& low, Data& high) {
+    DEB_MEMBER_FUNCT();
+    u_int32_t* plow = (u_int32_t*)initBulkData(low, Data::UINT32, sizeof(u_int32_t), m_nb_chans, 1);
+    u_int32_t* phigh = (u_int32_t*)initBulkData(high, Data::UINT32, sizeof(u_int32_t), m_nb_chans, 1);
+    for (int chan = 0; chan < m_nb_chans; chan++) {
+        u_int32_t l, h;
+        getWindow(chan, win, l, h);
+        plow[chan] = l;
+        phigh[chan] = h;
+    }
+}
+
+/**
+ * Set the good event thresholds of every channel.
+ *
+ * @param[in] good_thres the thresholds [nb_chans]
+ */
+void Camera::setGoodThresholds(Data& good_thres) {
+    DEB_MEMBER_FUNCT();
+    vector<double> values;
+    getBulkValues(good_thres, 1, "good event thresholds", values);
+    for (int chan = 0; chan < m_nb_chans; chan++) {
+        if (values[chan] < 0) {
+            THROW_HW_ERROR(InvalidValue) << "Invalid good event threshold " << values[chan] << " on channel " << chan;
+        }
+    }
+    vector<int> nbins;
+    applyBulk(BulkGoodThres, values, 1, nbins);
+}
+
+/**
+ * Get the good event thresholds of every channel.
+ *
+ * @param[out] good_thres the thresholds [nb_chans]
+ */
+void Camera::getGoodThresholds(Data& good_thres) {
+    DEB_MEMBER_FUNCT();
+    u_int32_t* ptr = (u_int32_t*)initBulkData(good_thres, Data::UINT32, sizeof(u_int32_t), m_nb_chans, 1);
+    for (int chan = 0; chan < m_nb_chans; chan++) {
+        u_int32_t value;
+        getGoodThreshold(chan, value);
+        ptr[chan] = value;
+    }
+}
+
+/**
+ * Set the energy scaling of every channel.
+ *
+ * @param[in] scaling the scalings [nb_chans] (0.5 to 2.0, negative for no scaling)
+ */
+void Camera::setScalings(Data& scaling) {
+    DEB_MEMBER_FUNCT();
+    vector<double> values;
+    getBulkValues(scaling, 1, "scalings", values);
+    for (int chan = 0; chan < m_nb_chans; chan++) {
+        if (values[chan] >= 0.0 && (values[chan] < 0.5 || values[chan] > 2.0)) {
+            THROW_HW_ERROR(InvalidValue) << "Invalid scaling " << values[chan] << " on channel " << chan
+                                         << ", should be 0.5 to 2.0";
+        }
+    }
+    vector<int> nbins;
+    applyBulk(BulkScaling, values, 1, nbins);
+}
+
+/**
+ * Set the input data source of every channel.
+ *
+ * @param[in] data_src the data sources [nb_chans] {@see DataSrc}
+ */
+void Camera::setDataSources(Data& data_src) {
+    DEB_MEMBER_FUNCT();
+    vector<double> values;
+    getBulkValues(data_src, 1, "data sources", values);
+    for (int chan = 0; chan < m_nb_chans; chan++) {
+        int src = (int)values[chan];
+        if (src != Normal && src != Alternate && src != Multiplexer && src != PlaybackStream0 && src != PlaybackStream1) {
+            THROW_HW_ERROR(InvalidValue) << "Invalid data source " << values[chan] << " on channel " << chan;
+        }
+    }
+    vector<int> nbins;
+    applyBulk(BulkDataSrc, values, 1, nbins);
+}
+
+/**
+ * Get the input data source of every channel.
+ *
+ * @param[out] data_src the data sources [nb_chans] {@see DataSrc}
+ */
+void Camera::getDataSources(Data& data_src) {
+    DEB_MEMBER_FUNCT();
+    int32_t* ptr = (int32_t*)initBulkData(data_src, Data::INT32, sizeof(int32_t), m_nb_chans, 1);
+    for (int chan = 0; chan < m_nb_chans; chan++) {
+        DataSrc src;
+        getDataSource(chan, src);
+        ptr[chan] = src;
+    }
+}
+
+/**
+ * Set the dead time correction parameters of every channel.
+ *
+ * @param[in] params [nb_chans][6] processDeadTimeAllEventGradient, processDeadTimeAllEventOffset,
+ *            processDeadTimeInWindowOffset, processDeadTimeInWindowGradient, useGoodEvent, omitChannel
+ */
+void Camera::setDeadtimeCorrectionParameterTable(Data& params) {
+    DEB_MEMBER_FUNCT();
+    vector<double> values;
+    getBulkValues(params, 6, "dead time correction parameters", values);
+    vector<int> nbins;
+    applyBulk(BulkDtc, values, 6, nbins);
+}
+
+/**
+ * Get the dead time correction parameters of every channel.
+ *
+ * @param[out] params [nb_chans][6] as for {@link #setDeadtimeCorrectionParameterTable()}
+ */
+void Camera::getDeadtimeCorrectionParameterTable(Data& params) {
+    DEB_MEMBER_FUNCT();
+    double* ptr = (double*)initBulkData(params, Data::DOUBLE, sizeof(double), m_nb_chans, 6);
+    for (int chan = 0; chan < m_nb_chans; chan++) {
+        int flags;
+        double* cptr = ptr + chan * 6;
+        getDtcParams(chan, flags, cptr);
+        cptr[4] = (flags & XSP3_DTC_USE_GOOD_EVENT) ? 1.0 : 0.0;
+        cptr[5] = (flags & XSP3_DTC_OMIT_CHANNEL) ? 1.0 : 0.0;
+    }
+}
+
+/**
+ * Set the regions of interest of every channel.
+ *
+ * @param[in] rois [nb_chans][num_roi][3] lhs, rhs and bins of each region, 1 to 8 regions per channel
+ * @param[out] nbins the number of bins of each channel [nb_chans]
+ */
+void Camera::setRois(Data& rois, Data& nbins) {
+    DEB_MEMBER_FUNCT();
+    int num_roi = (m_nb_chans > 0) ? getDataCount(rois) / (m_nb_chans * 3) : 0;
+    if (num_roi < 1 || num_roi > 8) {
+        THROW_HW_ERROR(InvalidValue) << "Invalid regions of interest, expected " << m_nb_chans
+                                     << " channels x 1 to 8 regions x 3 values";
+    }
+    vector<double> values;
+    getBulkValues(rois, num_roi * 3, "regions of interest", values);
+    vector<int> chan_nbins;
+    int32_t* ptr = (int32_t*)initBulkData(nbins, Data::INT32, sizeof(int32_t), m_nb_chans, 1);
+    applyBulk(BulkRoi, values, num_roi * 3, chan_nbins);
+    for (int chan = 0; chan < m_nb_chans; chan++) {
+        ptr[chan] = chan_nbins[chan];
+    }
+}
+
 /**
  * Setup xspress3 internal time frame generator.
  *
@@ -1689,10 +4522,12 @@ void Camera::setDataSource(int chan, DataSrc data_src) {
 //void setItfgTiming(int nframes, ItfgTriggerMode triggerMode, ItfgGapMode gapMode) {
 void Camera::setItfgTiming(int nframes, int triggerMode, int gapMode) {
     DEB_MEMBER_FUNCT();
+    waitInit();
     int trig_mode;
     u_int32_t itime;
     int gap_mode;
 
+    m_timing_valid = false;
     if (m_exp_time <= 0.0) {
         THROW_HW_ERROR(Error) << "Exposure time has not been set";
     }
@@ -1740,6 +4575,7 @@ void Camera::setItfgTiming(int nframes, int triggerMode, int gapMode) {
     }
     DEB_TRACE() << DEB_VAR4(nframes, itime, trig_mode, gap_mode);
     // use cardNos = 0 even in multi card systems for synchronisation
+    m_timing_writes++;
     if (xsp3_itfg_setup(m_handle, 0, nframes, itime, trig_mode, gap_mode) < 0) {
         THROW_HW_ERROR(Error) << xsp3_get_error_message();
     }
@@ -0,0 +1,236 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+
+#include "Xspress3Dtc.h"
+#include "xspress3.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define XSP3_DTC_SSE2
+#include <emmintrin.h>
+#endif
+
+// AVX2 code is built with the target attribute and selected at run time
+#if defined(XSP3_DTC_SSE2) && defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define XSP3_DTC_AVX2
+#include <immintrin.h>
+#endif
+
+using namespace lima::Xspress3;
+
+//---------------------------
+//- histogram kernels, one channel
+//---------------------------
+template <class T>
+static void histScalar(const u_int32_t* src, int npixels, double factor, T* dst) {
+    for (int i = 0; i < npixels; i++) {
+        dst[i] = (T)(src[i] * factor);
+    }
+}
+
+#ifdef XSP3_DTC_SSE2
+// unsigned 32 bit to double: flip the sign bit, convert as signed and add 2^31 back
+static inline __m128d cvtU32Pd(__m128i v) {
+    return _mm_add_pd(_mm_cvtepi32_pd(_mm_xor_si128(v, _mm_set1_epi32(0x80000000))), _mm_set1_pd(2147483648.0));
+}
+
+static void histSse2(const u_int32_t* src, int npixels, double factor, double* dst) {
+    const __m128d f = _mm_set1_pd(factor);
+    int i = 0;
+    for (; i + 4 <= npixels; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_pd(dst + i, _mm_mul_pd(cvtU32Pd(v), f));
+        _mm_storeu_pd(dst + i + 2, _mm_mul_pd(cvtU32Pd(_mm_srli_si128(v, 8)), f));
+    }
+    histScalar(src + i, npixels - i, factor, dst + i);
+}
+
+static void histSse2(const u_int32_t* src, int npixels, double factor, float* dst) {
+    const __m128d f = _mm_set1_pd(factor);
+    int i = 0;
+    for (; i + 4 <= npixels; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128 lo = _mm_cvtpd_ps(_mm_mul_pd(cvtU32Pd(v), f));
+        __m128 hi = _mm_cvtpd_ps(_mm_mul_pd(cvtU32Pd(_mm_srli_si128(v, 8)), f));
+        _mm_storeu_ps(dst + i, _mm_movelh_ps(lo, hi));
+    }
+    histScalar(src + i, npixels - i, factor, dst + i);
+}
+#endif
+
+#ifdef XSP3_DTC_AVX2
+__attribute__((target("avx2")))
+static inline __m256d cvtU32Pd256(__m128i v) {
+    return _mm256_add_pd(_mm256_cvtepi32_pd(_mm_xor_si128(v, _mm_set1_epi32(0x80000000))), _mm256_set1_pd(2147483648.0));
+}
+
+__attribute__((target("avx2")))
+static void histAvx2(const u_int32_t* src, int npixels, double factor, double* dst) {
+    const __m256d f = _mm256_set1_pd(factor);
+    int i = 0;
+    for (; i + 8 <= npixels; i += 8) {
+        __m128i v0 = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i v1 = _mm_loadu_si128((const __m128i*)(src + i + 4));
+        _mm256_storeu_pd(dst + i, _mm256_mul_pd(cvtU32Pd256(v0), f));
+        _mm256_storeu_pd(dst + i + 4, _mm256_mul_pd(cvtU32Pd256(v1), f));
+    }
+    histScalar(src + i, npixels - i, factor, dst + i);
+}
+
+__attribute__((target("avx2")))
+static void histAvx2(const u_int32_t* src, int npixels, double factor, float* dst) {
+    const __m256d f = _mm256_set1_pd(factor);
+    int i = 0;
+    for (; i + 8 <= npixels; i += 8) {
+        __m128i v0 = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i v1 = _mm_loadu_si128((const __m128i*)(src + i + 4));
+        _mm_storeu_ps(dst + i, _mm256_cvtpd_ps(_mm256_mul_pd(cvtU32Pd256(v0), f)));
+        _mm_storeu_ps(dst + i + 4, _mm256_cvtpd_ps(_mm256_mul_pd(cvtU32Pd256(v1), f)));
+    }
+    histScalar(src + i, npixels - i, factor, dst + i);
+}
+#endif
+
+template <class T>
+static void correctHist(DtcKernel::Isa isa, const u_int32_t* src, int src_stride, int nb_chans, int npixels,
+        const double* factors, T* dst) {
+    for (int chan = 0; chan < nb_chans; chan++) {
+        const u_int32_t* sptr = src + (size_t)chan * src_stride;
+        T* dptr = dst + (size_t)chan * npixels;
+        switch (isa) {
+#ifdef XSP3_DTC_AVX2
+        case DtcKernel::Avx2:
+            histAvx2(sptr, npixels, factors[chan], dptr);
+            break;
+#endif
+#ifdef XSP3_DTC_SSE2
+        case DtcKernel::Sse2:
+            histSse2(sptr, npixels, factors[chan], dptr);
+            break;
+#endif
+        default:
+            histScalar(sptr, npixels, factors[chan], dptr);
+            break;
+        }
+    }
+}
+
+template <class T>
+static void correctScal(const u_int32_t* src, int src_stride, int nb_chans, int nscalers,
+        const double* factors, const double* all_event, const int* flags, T* dst) {
+    for (int chan = 0; chan < nb_chans; chan++) {
+        const u_int32_t* sptr = src + (size_t)chan * src_stride;
+        T* dptr = dst + (size_t)chan * nscalers;
+        bool good_event = flags[chan] & XSP3_DTC_USE_GOOD_EVENT;
+        for (int k = 0; k < nscalers; k++) {
+            if (k == XSP3_SCALER_INWINDOW0 || k == XSP3_SCALER_INWINDOW1) {
+                dptr[k] = (T)(sptr[k] * factors[chan]);
+            } else if ((k == XSP3_SCALER_ALLEVENT && !good_event) || (k == XSP3_SCALER_ALLGOOD && good_event)) {
+                dptr[k] = (T)all_event[chan];
+            } else {
+                dptr[k] = (T)sptr[k];
+            }
+        }
+    }
+}
+
+//---------------------------
+//- DtcKernel
+//---------------------------
+DtcKernel::DtcKernel() : m_isa(getBestIsa()) {
+}
+
+/**
+ * Get the fastest instruction set supported by the build and the cpu.
+ */
+DtcKernel::Isa DtcKernel::getBestIsa() {
+#ifdef XSP3_DTC_AVX2
+    if (__builtin_cpu_supports("avx2"))
+        return Avx2;
+#endif
+#ifdef XSP3_DTC_SSE2
+    return Sse2;
+#else
+    return Scalar;
+#endif
+}
+
+/**
+ * Select the instruction set, limited to the best one available.
+ */
+void DtcKernel::setIsa(Isa isa) {
+    Isa best = getBestIsa();
+    m_isa = (isa > best) ? best : isa;
+}
+
+const char* DtcKernel::getIsaName(Isa isa) {
+    switch (isa) {
+    case Avx2:
+        return "AVX2";
+    case Sse2:
+        return "SSE2";
+    default:
+        return "Scalar";
+    }
+}
+
+/**
+ * Dead time correct the histograms of consecutive channels.
+ *
+ * @param[in] src the histogram of the first channel
+ * @param[in] src_stride the distance between two channels in src (npixels + nscalers in a Lima frame)
+ * @param[in] nb_chans the number of channels
+ * @param[in] npixels the number of bins per histogram
+ * @param[in] factors the dead time correction factor of each channel
+ * @param[out] dst nb_chans x npixels corrected bins
+ */
+void DtcKernel::correctHistograms(const u_int32_t* src, int src_stride, int nb_chans, int npixels,
+        const double* factors, double* dst) const {
+    correctHist(m_isa, src, src_stride, nb_chans, npixels, factors, dst);
+}
+
+void DtcKernel::correctHistograms(const u_int32_t* src, int src_stride, int nb_chans, int npixels,
+        const double* factors, float* dst) const {
+    correctHist(m_isa, src, src_stride, nb_chans, npixels, factors, dst);
+}
+
+/**
+ * Dead time correct the scalers of consecutive channels. The in-window scalers are scaled by the
+ * correction factor and the all-event (or all-good) scaler is replaced by the estimated input count.
+ *
+ * @param[in] src the scalers of the first channel
+ * @param[in] src_stride the distance between two channels in src
+ * @param[in] nb_chans the number of channels
+ * @param[in] nscalers the number of scalers per channel
+ * @param[in] factors the dead time correction factor of each channel
+ * @param[in] all_event the estimated input count of each channel
+ * @param[in] flags the dead time correction flags of each channel
+ * @param[out] dst nb_chans x nscalers corrected scalers
+ */
+void DtcKernel::correctScalers(const u_int32_t* src, int src_stride, int nb_chans, int nscalers,
+        const double* factors, const double* all_event, const int* flags, double* dst) {
+    correctScal(src, src_stride, nb_chans, nscalers, factors, all_event, flags, dst);
+}
+
+void DtcKernel::correctScalers(const u_int32_t* src, int src_stride, int nb_chans, int nscalers,
+        const double* factors, const double* all_event, const int* flags, float* dst) {
+    correctScal(src, src_stride, nb_chans, nscalers, factors, all_event, flags, dst);
+}
@@ -0,0 +1,460 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+
+#include <cstring>
+#include <sstream>
+#include <time.h>
+#include "lima/Exceptions.h"
+#include "Xspress3HdfWriter.h"
+
+using namespace lima;
+using namespace lima::Xspress3;
+using namespace H5;
+using namespace std;
+
+static const int DefFramesPerWrite = 64;
+static const int NbBlocks = 4;
+static const char* ScalerNames[] =
+		{ "Time", "ResetTicks", "ResetCount", "AllEvent", "AllGood", "InWindow0", "InWindow1", "PileUp", "TotalTicks" };
+static const char* DtcNames[] =
+		{ "processDeadTimeAllEventGradient", "processDeadTimeAllEventOffset",
+		  "processDeadTimeInWindowOffset", "processDeadTimeInWindowGradient" };
+
+//---------------------------
+//- Writer thread
+//---------------------------
+class HdfWriter::WriteThread: public Thread {
+DEB_CLASS_NAMESPC(DebModCamera, "HdfWriter", "WriteThread");
+public:
+	WriteThread(HdfWriter& writer);
+	virtual ~WriteThread();
+protected:
+	virtual void threadFunction();
+private:
+	HdfWriter& m_writer;
+	int m_placement_gen;
+};
+
+HdfWriter::WriteThread::WriteThread(HdfWriter& writer) : m_writer(writer), m_placement_gen(-1) {
+	pthread_attr_setscope(&m_thread_attr, PTHREAD_SCOPE_PROCESS);
+}
+
+HdfWriter::WriteThread::~WriteThread() {
+	AutoMutex aLock(m_writer.m_cond.mutex());
+	m_writer.m_quit = true;
+	m_writer.m_cond.broadcast();
+	aLock.unlock();
+}
+
+void HdfWriter::WriteThread::threadFunction() {
+	DEB_MEMBER_FUNCT();
+	AutoMutex aLock(m_writer.m_cond.mutex());
+
+	while (!m_writer.m_quit) {
+		while (m_writer.m_full_blocks.empty() && !m_writer.m_quit) {
+			m_writer.m_cond.wait();
+		}
+		if (m_writer.m_quit)
+			break;
+		Block* block = m_writer.m_full_blocks.front();
+		m_writer.m_writing = true;
+		bool failed = !m_writer.m_error.empty();
+		aLock.unlock();
+		if (m_writer.m_placement != NULL) {
+			m_writer.m_placement->update(ThreadPlacement::Writer, m_placement_gen);
+		}
+
+		// after an error the frames are dropped, the file is not usable
+		string error;
+		if (!failed) {
+			try {
+				m_writer.writeBlock(*block);
+			} catch (H5::Exception& e) {
+				error = e.getCDetailMsg();
+				DEB_ERROR() << "HDF5 write of frames " << block->first_frame << " failed: " << error;
+			}
+		}
+
+		aLock.lock();
+		m_writer.m_full_blocks.pop_front();
+		m_writer.m_free_blocks.push_back(block);
+		m_writer.m_writing = false;
+		if (!error.empty()) {
+			m_writer.m_error = error;
+		} else if (!failed) {
+			m_writer.m_nb_written += block->nb_frames;
+			m_writer.m_write_time = Timestamp::now();
+		}
+		m_writer.m_cond.broadcast();
+	}
+}
+
+//---------------------------
+//- HdfWriter
+//---------------------------
+HdfWriter::HdfWriter(ThreadPlacement* placement) : m_frames_per_write(DefFramesPerWrite), m_nb_chans(0), m_npixels(0),
+		m_nscalers(0), m_raw_frames(true), m_dtc(false), m_open(false), m_writing(false), m_quit(false),
+		m_nb_added(0), m_nb_written(0), m_cur_block(NULL), m_placement(placement) {
+	DEB_CONSTRUCTOR();
+	H5::Exception::dontPrint();
+	m_write_thread = new WriteThread(*this);
+	m_write_thread->start();
+}
+
+HdfWriter::~HdfWriter() {
+	DEB_DESTRUCTOR();
+	try {
+		close();
+	} catch (...) {
+	}
+	delete m_write_thread;
+	clearBlocks();
+}
+
+/**
+ * Set the number of frames buffered before each write, also the chunk size of the datasets in frames.
+ *
+ * @param[in] nb_frames the number of frames per write
+ */
+void HdfWriter::setFramesPerWrite(int nb_frames) {
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(nb_frames);
+	AutoMutex aLock(m_cond.mutex());
+	if (nb_frames < 1) {
+		THROW_HW_ERROR(InvalidValue) << "Frames per write must be at least 1 " << DEB_VAR1(nb_frames);
+	}
+	if (m_open) {
+		THROW_HW_ERROR(Error) << "Cannot change the frames per write while a file is open";
+	}
+	m_frames_per_write = nb_frames;
+}
+
+/**
+ * Create a file and its datasets. Frames are then added with addFrame() until close().
+ *
+ * @param[in] filename the file, truncated if it exists
+ * @param[in] nb_chans the number of channels
+ * @param[in] npixels the number of histogram bins per channel
+ * @param[in] nscalers the number of scalers per channel
+ * @param[in] raw_frames true for raw Bpp32 frames, false for float32 frames corrected by the read thread
+ * @param[in] dtc write the dead time corrected data (always for corrected frames)
+ * @param[in] firmware the firmware version
+ * @param[in] dtc_energy the dead time calculation energy
+ * @param[in] dtc_params the 4 dead time correction parameters of each channel
+ */
+void HdfWriter::open(const string& filename, int nb_chans, int npixels, int nscalers, bool raw_frames, bool dtc,
+		const string& firmware, double dtc_energy, const vector<double>& dtc_params) {
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR5(filename, nb_chans, npixels, raw_frames, dtc);
+	close();
+
+	AutoMutex aLock(m_cond.mutex());
+	m_nb_chans = nb_chans;
+	m_npixels = npixels;
+	m_nscalers = nscalers;
+	m_raw_frames = raw_frames;
+	m_dtc = dtc || !raw_frames;
+	m_nb_added = 0;
+	m_nb_written = 0;
+	m_error.clear();
+	clearBlocks();
+	size_t frame_size = (size_t)m_nb_chans * (m_npixels + m_nscalers);
+	for (int i = 0; i < NbBlocks; i++) {
+		Block* block = new Block();
+		block->frames.resize(m_frames_per_write * frame_size);
+		if (m_raw_frames && m_dtc) {
+			block->factors.resize(m_frames_per_write * m_nb_chans);
+			block->all_event.resize(m_frames_per_write * m_nb_chans);
+			block->flags.resize(m_frames_per_write * m_nb_chans);
+		}
+		m_free_blocks.push_back(block);
+	}
+	m_buff.resize((size_t)m_frames_per_write * m_npixels);
+	m_fbuff.resize((size_t)m_frames_per_write * m_npixels);
+
+	try {
+		m_file = H5File(filename, H5F_ACC_TRUNC);
+		m_entry = m_file.createGroup("/Entry");
+		time_t now;
+		time(&now);
+		char buf[sizeof("2011-10-08T07:07:09Z")];
+		strftime(buf, sizeof(buf), "%FT%TZ", gmtime(&now));
+		writeString(m_entry, "start_time", buf);
+
+		Group instrument = m_entry.createGroup("Instrument");
+		Group detector = instrument.createGroup("Xspress3");
+		writeString(detector, "firmware-version", firmware);
+		stringstream energy;
+		energy << dtc_energy << "eV";
+		writeString(detector, "dtc-correction-energy", energy.str());
+
+		string names;
+		for (int k = 0; k < m_nscalers; k++) {
+			if (k)
+				names += ",";
+			if (k < (int)(sizeof(ScalerNames) / sizeof(ScalerNames[0]))) {
+				names += ScalerNames[k];
+			} else {
+				stringstream ss;
+				ss << "Scaler" << k;
+				names += ss.str();
+			}
+		}
+		StrType names_type(PredType::C_S1, names.size());
+
+		m_histogram.resize(m_nb_chans);
+		m_histogram_dtc.resize(m_nb_chans);
+		m_scaler.resize(m_nb_chans);
+		m_scaler_dtc.resize(m_nb_chans);
+		for (int chan = 0; chan < m_nb_chans; chan++) {
+			stringstream ss;
+			ss << "channel_";
+			(chan < 10) ? ss << "0" << chan : ss << chan;
+			Group group = detector.createGroup(ss.str());
+			if (m_raw_frames) {
+				m_histogram[chan] = createDataSet(group, "histogram", PredType::NATIVE_UINT32, m_npixels);
+				m_scaler[chan] = createDataSet(group, "scaler", PredType::NATIVE_UINT32, m_nscalers);
+				Attribute attr = m_scaler[chan].createAttribute("names", names_type, DataSpace(H5S_SCALAR));
+				attr.write(names_type, names);
+			}
+			if (m_dtc) {
+				m_histogram_dtc[chan] = createDataSet(group, "histogram-dtc", PredType::NATIVE_FLOAT, m_npixels);
+				m_scaler_dtc[chan] = createDataSet(group, "scaler-dtc", PredType::NATIVE_FLOAT, m_nscalers);
+				Attribute attr = m_scaler_dtc[chan].createAttribute("names", names_type, DataSpace(H5S_SCALAR));
+				attr.write(names_type, names);
+			}
+			Group dtc = group.createGroup("dtc-correction-parameters");
+			hsize_t dim[1] = {1};
+			DataSpace dataspace(1, dim);
+			for (int i = 0; i < 4 && (size_t)(chan * 4 + i) < dtc_params.size(); i++) {
+				DataSet dataset = dtc.createDataSet(DtcNames[i], PredType::NATIVE_DOUBLE, dataspace);
+				dataset.write(&dtc_params[chan * 4 + i], PredType::NATIVE_DOUBLE);
+			}
+		}
+	} catch (H5::Exception& e) {
+		m_histogram.clear();
+		m_histogram_dtc.clear();
+		m_scaler.clear();
+		m_scaler_dtc.clear();
+		m_entry.close();
+		m_file.close();
+		THROW_HW_ERROR(Error) << "Cannot create HDF5 file " << filename << ": " << e.getCDetailMsg();
+	}
+	m_open_time = Timestamp::now();
+	m_write_time = m_open_time;
+	m_open = true;
+}
+
+bool HdfWriter::isOpen() {
+	AutoMutex aLock(m_cond.mutex());
+	return m_open;
+}
+
+/**
+ * Add a frame (nb_chans rows of histogram bins followed by the scalers) to the file.
+ * The frame is copied, waiting for the write thread if all the blocks are full.
+ *
+ * @param[in] frame the Lima frame
+ * @param[in] factors the dead time correction factor of each channel (raw frames with dtc only)
+ * @param[in] all_event the estimated input count of each channel (raw frames with dtc only)
+ * @param[in] flags the dead time correction flags of each channel (raw frames with dtc only)
+ */
+void HdfWriter::addFrame(const u_int32_t* frame, const double* factors, const double* all_event, const int* flags) {
+	DEB_MEMBER_FUNCT();
+	AutoMutex aLock(m_cond.mutex());
+	if (!m_open || !m_error.empty())
+		return;
+	if (m_cur_block == NULL) {
+		while (m_free_blocks.empty()) {
+			m_cond.wait();
+		}
+		m_cur_block = m_free_blocks.back();
+		m_free_blocks.pop_back();
+		m_cur_block->first_frame = m_nb_added;
+		m_cur_block->nb_frames = 0;
+	}
+	Block& block = *m_cur_block;
+	size_t frame_size = (size_t)m_nb_chans * (m_npixels + m_nscalers);
+	memcpy(&block.frames[block.nb_frames * frame_size], frame, frame_size * sizeof(u_int32_t));
+	if (m_raw_frames && m_dtc) {
+		memcpy(&block.factors[block.nb_frames * m_nb_chans], factors, m_nb_chans * sizeof(double));
+		memcpy(&block.all_event[block.nb_frames * m_nb_chans], all_event, m_nb_chans * sizeof(double));
+		memcpy(&block.flags[block.nb_frames * m_nb_chans], flags, m_nb_chans * sizeof(int));
+	}
+	++m_nb_added;
+	if (++block.nb_frames == m_frames_per_write) {
+		m_full_blocks.push_back(m_cur_block);
+		m_cur_block = NULL;
+		m_cond.broadcast();
+	}
+}
+
+/**
+ * Write the remaining frames, wait for the write thread and close the file.
+ */
+void HdfWriter::close() {
+	DEB_MEMBER_FUNCT();
+	AutoMutex aLock(m_cond.mutex());
+	if (!m_open)
+		return;
+	if (m_cur_block != NULL) {
+		if (m_cur_block->nb_frames > 0) {
+			m_full_blocks.push_back(m_cur_block);
+		} else {
+			m_free_blocks.push_back(m_cur_block);
+		}
+		m_cur_block = NULL;
+		m_cond.broadcast();
+	}
+	while (!m_full_blocks.empty() || m_writing) {
+		m_cond.wait();
+	}
+	m_open = false;
+	DEB_TRACE() << "Closing HDF5 file " << DEB_VAR3(m_nb_added, m_nb_written, m_error);
+
+	try {
+		Group data = m_entry.createGroup("Data");
+		for (int chan = 0; chan < m_nb_chans; chan++) {
+			stringstream ss, ss2;
+			ss << "channel_";
+			(chan < 10) ? ss << "0" << chan : ss << chan;
+			ss2 << "/Entry/Instrument/Xspress3/" << ss.str() << (m_dtc ? "/histogram-dtc" : "/histogram");
+			data.link(H5L_TYPE_HARD, ss2.str(), ss.str());
+		}
+		time_t now;
+		time(&now);
+		char buf[sizeof("2011-10-08T07:07:09Z")];
+		strftime(buf, sizeof(buf), "%FT%TZ", gmtime(&now));
+		writeString(m_entry, "end_time", buf);
+	} catch (H5::Exception& e) {
+		DEB_ERROR() << "HDF5 file completion failed: " << e.getCDetailMsg();
+		if (m_error.empty())
+			m_error = e.getCDetailMsg();
+	}
+	m_histogram.clear();
+	m_histogram_dtc.clear();
+	m_scaler.clear();
+	m_scaler_dtc.clear();
+	m_entry.close();
+	m_file.close();
+}
+
+/**
+ * Get the number of frames written to the file and the write rate since it was opened.
+ *
+ * @param[out] nb_frames the number of frames written
+ * @param[out] frames_per_sec the average number of frames written per second
+ * @param[out] error the last write error, empty if none
+ */
+void HdfWriter::getStatus(int& nb_frames, double& frames_per_sec, string& error) {
+	DEB_MEMBER_FUNCT();
+	AutoMutex aLock(m_cond.mutex());
+	nb_frames = m_nb_written;
+	double elapsed = m_write_time - m_open_time;
+	frames_per_sec = (elapsed > 0.0) ? m_nb_written / elapsed : 0.0;
+	error = m_error;
+}
+
+/**
+ * Write a block of frames, one hyperslab per dataset (used by write thread only).
+ */
+void HdfWriter::writeBlock(Block& block) {
+	DEB_MEMBER_FUNCT();
+	int stride = m_npixels + m_nscalers;
+	int frame_size = m_nb_chans * stride;
+	int nb = block.nb_frames;
+
+	for (int chan = 0; chan < m_nb_chans; chan++) {
+		const u_int32_t* fptr = &block.frames[chan * stride];
+		if (m_raw_frames) {
+			for (int f = 0; f < nb; f++)
+				memcpy(&m_buff[f * m_npixels], fptr + f * frame_size, m_npixels * sizeof(u_int32_t));
+			writeSlab(m_histogram[chan], block.first_frame, nb, m_npixels, &m_buff[0], PredType::NATIVE_UINT32);
+			for (int f = 0; f < nb; f++)
+				memcpy(&m_buff[f * m_nscalers], fptr + f * frame_size + m_npixels, m_nscalers * sizeof(u_int32_t));
+			writeSlab(m_scaler[chan], block.first_frame, nb, m_nscalers, &m_buff[0], PredType::NATIVE_UINT32);
+		}
+		if (m_dtc) {
+			if (m_raw_frames) {
+				for (int f = 0; f < nb; f++) {
+					int k = f * m_nb_chans + chan;
+					m_dtc_kernel.correctHistograms(fptr + f * frame_size, stride, 1, m_npixels, &block.factors[k],
+							&m_fbuff[f * m_npixels]);
+				}
+			} else {
+				for (int f = 0; f < nb; f++)
+					memcpy(&m_fbuff[f * m_npixels], fptr + f * frame_size, m_npixels * sizeof(float));
+			}
+			writeSlab(m_histogram_dtc[chan], block.first_frame, nb, m_npixels, &m_fbuff[0], PredType::NATIVE_FLOAT);
+			if (m_raw_frames) {
+				for (int f = 0; f < nb; f++) {
+					int k = f * m_nb_chans + chan;
+					DtcKernel::correctScalers(fptr + f * frame_size + m_npixels, stride, 1, m_nscalers, &block.factors[k],
+							&block.all_event[k], &block.flags[k], &m_fbuff[f * m_nscalers]);
+				}
+			} else {
+				for (int f = 0; f < nb; f++)
+					memcpy(&m_fbuff[f * m_nscalers], fptr + f * frame_size + m_npixels, m_nscalers * sizeof(float));
+			}
+			writeSlab(m_scaler_dtc[chan], block.first_frame, nb, m_nscalers, &m_fbuff[0], PredType::NATIVE_FLOAT);
+		}
+	}
+}
+
+void HdfWriter::writeSlab(DataSet& dataset, int first_frame, int nb_frames, int width, const void* buff,
+		const PredType& type) {
+	hsize_t dims[2] = {(hsize_t)(first_frame + nb_frames), (hsize_t)width};
+	dataset.extend(dims);
+	DataSpace filespace = dataset.getSpace();
+	hsize_t offset[2] = {(hsize_t)first_frame, 0};
+	hsize_t count[2] = {(hsize_t)nb_frames, (hsize_t)width};
+	filespace.selectHyperslab(H5S_SELECT_SET, count, offset);
+	DataSpace memspace(2, count);
+	dataset.write(buff, type, memspace, filespace);
+}
+
+/**
+ * Create an extensible [frames][width] dataset chunked by frames_per_write whole frames.
+ */
+DataSet HdfWriter::createDataSet(Group& group, const string& name, const PredType& type, int width) {
+	hsize_t dims[2] = {0, (hsize_t)width};
+	hsize_t maxdims[2] = {H5S_UNLIMITED, (hsize_t)width};
+	DataSpace dataspace(2, dims, maxdims);
+	DSetCreatPropList plist;
+	hsize_t chunk[2] = {(hsize_t)m_frames_per_write, (hsize_t)width};
+	plist.setChunk(2, chunk);
+	return group.createDataSet(name, type, dataspace, plist);
+}
+
+void HdfWriter::writeString(Group& group, const string& name, const string& value) {
+	hsize_t strdim[] = {1};
+	DataSpace dataspace(1, strdim);
+	StrType datatype(PredType::C_S1, value.empty() ? 1 : value.size());
+	DataSet dataset = group.createDataSet(name, datatype, dataspace);
+	dataset.write(value, datatype);
+}
+
+void HdfWriter::clearBlocks() {
+	for (size_t i = 0; i < m_free_blocks.size(); i++)
+		delete m_free_blocks[i];
+	m_free_blocks.clear();
+}
@@ -74,8 +74,7 @@ void Interface::reset(ResetLevel reset_level) {
 	DEB_MEMBER_FUNCT();
 	DEB_PARAM() << DEB_VAR1(reset_level);
 
-	stopAcq();
-	m_cam.reset();
+	m_cam.reset(reset_level == SoftReset ? Camera::ResetSoft : Camera::ResetHard);
 }
 
 void Interface::prepareAcq() {
@@ -95,6 +94,18 @@ void Interface::stopAcq() {
 
 void Interface::getStatus(StatusType& status) {
 	DEB_MEMBER_FUNCT();
+	Camera::InitState init_state;
+	string progress, error;
+	m_cam.getInitState(init_state, progress, error);
+	if (init_state == Camera::Initialising) {
+		status.acq = AcqConfig;
+		status.det = DetIdle;
+		return;
+	} else if (init_state != Camera::Initialised) {
+		status.acq = AcqFault;
+		status.det = DetFault;
+		return;
+	}
 	Camera::Status xspress3_status;
 	m_cam.getStatus(xspress3_status);
 	switch (xspress3_status) {
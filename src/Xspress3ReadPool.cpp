@@ -0,0 +1,220 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include "lima/Exceptions.h"
+#include "Xspress3ReadPool.h"
+
+using namespace lima;
+using namespace lima::Xspress3;
+using namespace std;
+
+//---------------------------
+//- Worker thread
+//---------------------------
+class ReadPool::WorkerThread: public Thread {
+DEB_CLASS_NAMESPC(DebModCamera, "ReadPool", "WorkerThread");
+public:
+    WorkerThread(ReadPool& pool, int worker);
+    virtual ~WorkerThread();
+protected:
+    virtual void threadFunction();
+private:
+    ReadPool& m_pool;
+    int m_worker;
+    int m_job; // last run() done
+    int m_placement_gen;
+    bool m_quit;
+};
+
+ReadPool::WorkerThread::WorkerThread(ReadPool& pool, int worker) : m_pool(pool), m_worker(worker), m_placement_gen(-1), m_quit(false) {
+    AutoMutex aLock(m_pool.m_cond.mutex());
+    m_job = m_pool.m_job;
+    aLock.unlock();
+    pthread_attr_setscope(&m_thread_attr, PTHREAD_SCOPE_PROCESS);
+}
+
+ReadPool::WorkerThread::~WorkerThread() {
+    AutoMutex aLock(m_pool.m_cond.mutex());
+    m_quit = true;
+    m_pool.m_cond.broadcast();
+    aLock.unlock();
+}
+
+void ReadPool::WorkerThread::threadFunction() {
+    DEB_MEMBER_FUNCT();
+    AutoMutex aLock(m_pool.m_cond.mutex());
+
+    while (true) {
+        while (m_job == m_pool.m_job && !m_quit) {
+            m_pool.m_cond.wait();
+        }
+        if (m_quit)
+            return;
+        m_job = m_pool.m_job;
+        Task* task = m_pool.m_task;
+        int nb_chans = m_pool.m_nb_chans;
+        aLock.unlock();
+        if (m_pool.m_placement != NULL) {
+            m_pool.m_placement->update(ThreadPlacement::Read, m_placement_gen);
+        }
+
+        // own tasks first, then help the others, after an error the remaining tasks are dropped
+        string error;
+        int idx;
+        while (m_pool.popTask(m_worker, idx) || m_pool.stealTask(m_worker, idx)) {
+            if (!error.empty())
+                continue;
+            try {
+                task->run(idx / nb_chans, idx % nb_chans);
+            } catch (Exception& e) {
+                error = e.getErrMsg();
+            }
+        }
+
+        aLock.lock();
+        if (!error.empty() && m_pool.m_error.empty()) {
+            m_pool.m_error = error;
+        }
+        if (--m_pool.m_pending == 0) {
+            m_pool.m_cond.broadcast();
+        }
+    }
+}
+
+//---------------------------
+//- ReadPool
+//---------------------------
+ReadPool::ReadPool() : m_placement(NULL), m_task(NULL), m_nb_chans(0), m_job(0), m_pending(0), m_nb_tasks(0), m_nb_stolen(0) {
+    DEB_CONSTRUCTOR();
+}
+
+ReadPool::~ReadPool() {
+    DEB_DESTRUCTOR();
+    stopThreads();
+}
+
+void ReadPool::stopThreads() {
+    for (size_t i = 0; i < m_threads.size(); i++) {
+        delete m_threads[i];
+    }
+    m_threads.clear();
+    for (size_t i = 0; i < m_queues.size(); i++) {
+        delete m_queues[i];
+    }
+    m_queues.clear();
+}
+
+/**
+ * Set the number of worker threads, 0 stops the pool. Must not be called during run().
+ *
+ * @param[in] nb_threads the number of worker threads
+ */
+void ReadPool::setNbThreads(int nb_threads) {
+    DEB_MEMBER_FUNCT();
+    DEB_PARAM() << DEB_VAR1(nb_threads);
+    if (nb_threads < 0) {
+        THROW_HW_ERROR(InvalidValue) << "Invalid number of threads " << nb_threads;
+    }
+    if (nb_threads == (int)m_threads.size())
+        return;
+    stopThreads();
+    for (int i = 0; i < nb_threads; i++) {
+        m_queues.push_back(new Queue);
+    }
+    for (int i = 0; i < nb_threads; i++) {
+        m_threads.push_back(new WorkerThread(*this, i));
+        m_threads.back()->start();
+    }
+}
+
+/**
+ * Run task for every frame and channel of a block and wait for all of them to complete.
+ *
+ * @param[in] task the task
+ * @param[in] nb_frames the number of frames of the block
+ * @param[in] nb_chans the number of channels per frame
+ */
+void ReadPool::run(Task& task, int nb_frames, int nb_chans) {
+    DEB_MEMBER_FUNCT();
+    int nb_tasks = nb_frames * nb_chans;
+    int nb_workers = m_threads.size();
+    if (nb_workers == 0) {
+        THROW_HW_ERROR(Error) << "No read pool threads";
+    }
+    // contiguous shares, a worker then mostly reads consecutive channels of the same frames
+    for (int worker = 0; worker < nb_workers; worker++) {
+        Queue& queue = *m_queues[worker];
+        AutoMutex qLock(queue.mutex);
+        for (int idx = worker * nb_tasks / nb_workers; idx < (worker + 1) * nb_tasks / nb_workers; idx++) {
+            queue.tasks.push_back(idx);
+        }
+    }
+
+    AutoMutex aLock(m_cond.mutex());
+    m_task = &task;
+    m_nb_chans = nb_chans;
+    m_pending = nb_workers;
+    m_error.clear();
+    m_nb_tasks += nb_tasks;
+    m_job++;
+    m_cond.broadcast();
+    while (m_pending > 0) {
+        m_cond.wait();
+    }
+    m_task = NULL;
+    if (!m_error.empty()) {
+        THROW_HW_ERROR(Error) << m_error;
+    }
+}
+
+bool ReadPool::popTask(int worker, int& task) {
+    Queue& queue = *m_queues[worker];
+    AutoMutex qLock(queue.mutex);
+    if (queue.tasks.empty())
+        return false;
+    task = queue.tasks.front();
+    queue.tasks.pop_front();
+    return true;
+}
+
+bool ReadPool::stealTask(int worker, int& task) {
+    int nb_workers = m_queues.size();
+    for (int i = 1; i < nb_workers; i++) {
+        Queue& queue = *m_queues[(worker + i) % nb_workers];
+        AutoMutex qLock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = queue.tasks.back();
+            queue.tasks.pop_back();
+            __sync_fetch_and_add(&m_nb_stolen, 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Get the number of tasks run and of tasks stolen from another worker since the pool was created.
+ */
+void ReadPool::getStats(long long& nb_tasks, long long& nb_stolen) {
+    AutoMutex aLock(m_cond.mutex());
+    nb_tasks = m_nb_tasks;
+    nb_stolen = m_nb_stolen;
+}
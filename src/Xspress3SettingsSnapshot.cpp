@@ -0,0 +1,305 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include "lima/Exceptions.h"
+#include "xspress3.h"
+#include "Xspress3SettingsSnapshot.h"
+
+using namespace lima;
+using namespace lima::Xspress3;
+using namespace std;
+
+static const char Magic[8] = {'X', 'S', 'P', '3', 'S', 'N', 'A', 'P'};
+static const int Version = 2;
+
+// global registers programmed by init() and prepareAcq(), left out of the snapshot. TIMING_A also holds the run
+// and count enable control bits, which a save during an acquisition would capture
+static bool isExcludedGlobReg(int offset) {
+    return offset == XSP3_GLOB_CLOCK_CONT || offset == XSP3_GLOB_MDIO_WRITE ||
+            offset == XSP3_GLOB_TIMING_A || offset == XSP3_GLOB_TIMING_FIXED ||
+            offset == XSP3_GLOB_ITFG_FRAME_LEN || offset == XSP3_GLOB_ITFG_NUM_FRAMES;
+}
+
+template <class T> static void put(ostream& os, const T& value) {
+    os.write((const char*)&value, sizeof(T));
+}
+
+template <class T> static void get(istream& is, T& value) {
+    is.read((char*)&value, sizeof(T));
+}
+
+SettingsSnapshot::SettingsSnapshot() : m_revision(0), m_nb_cards(0), m_nb_chans(0), m_dtc_energy(0.0), m_hash(0) {
+}
+
+/**
+ * Read the settings from the hardware.
+ *
+ * @param[in] handle the sdk top level path
+ * @param[in] nb_cards the number of cards
+ * @param[in] nb_chans the number of channels
+ */
+void SettingsSnapshot::read(int handle, int nb_cards, int nb_chans) {
+    DEB_MEMBER_FUNCT();
+    m_blocks.clear();
+    if ((m_revision = xsp3_get_revision(handle)) < 0) {
+        THROW_HW_ERROR(Error) << xsp3_get_error_message();
+    }
+    m_nb_cards = nb_cards;
+    m_nb_chans = nb_chans;
+    for (int card = 0; card < nb_cards; card++) {
+        Block block;
+        block.kind = GlobRegs;
+        block.index = card;
+        block.region = XSP3_REGION_GLOB_REG;
+        block.words.resize(XSP3_NUM_GLOB_REG);
+        if (xsp3_read_glob_reg(handle, card, 0, XSP3_NUM_GLOB_REG, &block.words[0]) < 0) {
+            THROW_HW_ERROR(Error) << "card " << card << ": " << xsp3_get_error_message();
+        }
+        for (int offset = 0; offset < XSP3_NUM_GLOB_REG; offset++) {
+            if (isExcludedGlobReg(offset))
+                block.words[offset] = 0;
+        }
+        m_blocks.push_back(block);
+    }
+    m_dtc_flags.resize(nb_chans);
+    m_dtc_params.resize(nb_chans * 4);
+    for (int chan = 0; chan < nb_chans; chan++) {
+        for (int region = XSP3_REGION_REGS; region <= XSP3_REGION_RAM_MAX; region++) {
+            int size = XSP3_REGS_SIZE;
+            if (region != XSP3_REGION_REGS) {
+                if (xsp3_has_bram(handle, chan, region) <= 0 || (size = xsp3_bram_size(handle, chan, region)) <= 0)
+                    continue;
+            }
+            Block block;
+            block.kind = ChanRegs;
+            block.index = chan;
+            block.region = region;
+            block.words.resize(size);
+            if (xsp3_read_reg(handle, chan, region, 0, size, &block.words[0]) < 0) {
+                THROW_HW_ERROR(Error) << "channel " << chan << " region " << region << ": " << xsp3_get_error_message();
+            }
+            m_blocks.push_back(block);
+        }
+        double *pptr = &m_dtc_params[chan * 4];
+        if (xsp3_getDeadtimeCorrectionParameters(handle, chan, &m_dtc_flags[chan], pptr, pptr + 1, pptr + 2, pptr + 3) < 0) {
+            THROW_HW_ERROR(Error) << xsp3_get_error_message();
+        }
+    }
+    m_dtc_energy = xsp3_getDeadtimeCalculationEnergy(handle);
+    updateHash();
+}
+
+/**
+ * Write the snapshot to a file, through a temporary file so a reader never sees a partial snapshot.
+ */
+void SettingsSnapshot::save(const string& filename) const {
+    DEB_MEMBER_FUNCT();
+    string tmp_name = filename + ".tmp";
+    ofstream os(tmp_name.c_str(), ios::binary | ios::trunc);
+    if (!os) {
+        THROW_HW_ERROR(Error) << "Cannot create settings snapshot " << tmp_name << ": " << strerror(errno);
+    }
+    os.write(Magic, sizeof(Magic));
+    put(os, Version);
+    put(os, m_revision);
+    put(os, m_nb_cards);
+    put(os, m_nb_chans);
+    int nb_blocks = m_blocks.size();
+    put(os, nb_blocks);
+    for (int i = 0; i < nb_blocks; i++) {
+        const Block& block = m_blocks[i];
+        int size = block.words.size();
+        put(os, block.kind);
+        put(os, block.index);
+        put(os, block.region);
+        put(os, size);
+        os.write((const char*)&block.words[0], size * sizeof(u_int32_t));
+    }
+    os.write((const char*)&m_dtc_flags[0], m_nb_chans * sizeof(int));
+    os.write((const char*)&m_dtc_params[0], m_nb_chans * 4 * sizeof(double));
+    put(os, m_dtc_energy);
+    put(os, m_hash);
+    os.close();
+    if (!os) {
+        THROW_HW_ERROR(Error) << "Cannot write settings snapshot " << tmp_name;
+    }
+    if (rename(tmp_name.c_str(), filename.c_str()) < 0) {
+        THROW_HW_ERROR(Error) << "Cannot rename settings snapshot to " << filename << ": " << strerror(errno);
+    }
+}
+
+/**
+ * Read the snapshot from a file, the stored hash must match its contents.
+ */
+void SettingsSnapshot::load(const string& filename) {
+    DEB_MEMBER_FUNCT();
+    m_blocks.clear();
+    ifstream is(filename.c_str(), ios::binary);
+    if (!is) {
+        THROW_HW_ERROR(Error) << "Cannot open settings snapshot " << filename << ": " << strerror(errno);
+    }
+    char magic[sizeof(Magic)];
+    int version;
+    is.read(magic, sizeof(magic));
+    get(is, version);
+    if (!is || memcmp(magic, Magic, sizeof(Magic)) != 0 || version != Version) {
+        THROW_HW_ERROR(Error) << filename << " is not a version " << Version << " settings snapshot";
+    }
+    int nb_blocks;
+    get(is, m_revision);
+    get(is, m_nb_cards);
+    get(is, m_nb_chans);
+    get(is, nb_blocks);
+    if (!is || m_nb_chans < 0 || nb_blocks < 0) {
+        THROW_HW_ERROR(Error) << "Corrupt settings snapshot " << filename;
+    }
+    for (int i = 0; i < nb_blocks && is; i++) {
+        Block block;
+        int size;
+        get(is, block.kind);
+        get(is, block.index);
+        get(is, block.region);
+        get(is, size);
+        if (!is || size <= 0 || size > XSP3_MAX_BRAM_SIZE) {
+            THROW_HW_ERROR(Error) << "Corrupt settings snapshot " << filename;
+        }
+        block.words.resize(size);
+        is.read((char*)&block.words[0], size * sizeof(u_int32_t));
+        m_blocks.push_back(block);
+    }
+    m_dtc_flags.resize(m_nb_chans);
+    m_dtc_params.resize(m_nb_chans * 4);
+    is.read((char*)&m_dtc_flags[0], m_nb_chans * sizeof(int));
+    is.read((char*)&m_dtc_params[0], m_nb_chans * 4 * sizeof(double));
+    get(is, m_dtc_energy);
+    unsigned long long hash;
+    get(is, hash);
+    updateHash();
+    if (!is || hash != m_hash) {
+        m_blocks.clear();
+        THROW_HW_ERROR(Error) << "Corrupt settings snapshot " << filename;
+    }
+}
+
+/**
+ * Write the snapshot to the hardware, only the registers and parameters that differ from the current settings.
+ *
+ * @param[in] handle the sdk top level path
+ * @param[in] current the settings just read from the hardware
+ * @return the number of writes
+ */
+int SettingsSnapshot::restore(int handle, const SettingsSnapshot& current) const {
+    DEB_MEMBER_FUNCT();
+    if (current.m_nb_cards != m_nb_cards || current.m_nb_chans != m_nb_chans || current.m_blocks.size() != m_blocks.size()) {
+        THROW_HW_ERROR(Error) << "Settings snapshot of " << m_nb_cards << " cards and " << m_nb_chans
+                              << " channels does not match the system";
+    }
+    if (current.m_hash == m_hash) {
+        DEB_TRACE() << "Settings unchanged";
+        return 0;
+    }
+    int nb_writes = 0;
+    for (size_t i = 0; i < m_blocks.size(); i++) {
+        nb_writes += writeBlock(handle, m_blocks[i], current.m_blocks[i]);
+    }
+    for (int chan = 0; chan < m_nb_chans; chan++) {
+        const double *pptr = &m_dtc_params[chan * 4];
+        if (m_dtc_flags[chan] == current.m_dtc_flags[chan] && memcmp(pptr, &current.m_dtc_params[chan * 4], 4 * sizeof(double)) == 0)
+            continue;
+        if (xsp3_setDeadtimeCorrectionParameters(handle, chan, m_dtc_flags[chan], pptr[0], pptr[1], pptr[2], pptr[3]) < 0) {
+            THROW_HW_ERROR(Error) << xsp3_get_error_message();
+        }
+        nb_writes++;
+    }
+    if (m_dtc_energy != current.m_dtc_energy) {
+        if (xsp3_setDeadtimeCalculationEnergy(handle, m_dtc_energy) < 0) {
+            THROW_HW_ERROR(Error) << xsp3_get_error_message();
+        }
+        nb_writes++;
+    }
+    DEB_TRACE() << "Settings restored " << DEB_VAR1(nb_writes);
+    return nb_writes;
+}
+
+/**
+ * Write the runs of words of a block that differ from the current ones.
+ */
+int SettingsSnapshot::writeBlock(int handle, const Block& block, const Block& current) const {
+    DEB_MEMBER_FUNCT();
+    if (block.kind != current.kind || block.index != current.index || block.region != current.region
+            || block.words.size() != current.words.size()) {
+        THROW_HW_ERROR(Error) << "Settings snapshot layout does not match the system";
+    }
+    int nb_writes = 0;
+    int size = block.words.size();
+    int first = 0;
+    while (first < size) {
+        if (block.words[first] == current.words[first]) {
+            first++;
+            continue;
+        }
+        int last = first + 1;
+        while (last < size && block.words[last] != current.words[last]) {
+            last++;
+        }
+        u_int32_t* words = (u_int32_t*)&block.words[first];
+        int status = (block.kind == GlobRegs) ?
+                xsp3_write_glob_reg(handle, block.index, first, last - first, words) :
+                xsp3_write_reg(handle, block.index, block.region, first, last - first, words);
+        if (status < 0) {
+            THROW_HW_ERROR(Error) << ((block.kind == GlobRegs) ? "card " : "channel ") << block.index << " region "
+                                  << block.region << ": " << xsp3_get_error_message();
+        }
+        nb_writes++;
+        first = last;
+    }
+    return nb_writes;
+}
+
+/**
+ * 64 bit FNV-1a hash of the contents.
+ */
+void SettingsSnapshot::updateHash() {
+    unsigned long long hash = 14695981039346656037ULL;
+    const unsigned long long prime = 1099511628211ULL;
+    for (size_t i = 0; i < m_blocks.size(); i++) {
+        const unsigned char* p = (const unsigned char*)&m_blocks[i].words[0];
+        for (size_t j = 0; j < m_blocks[i].words.size() * sizeof(u_int32_t); j++) {
+            hash = (hash ^ p[j]) * prime;
+        }
+    }
+    const unsigned char* p = (const unsigned char*)&m_dtc_flags[0];
+    for (size_t j = 0; j < m_dtc_flags.size() * sizeof(int); j++) {
+        hash = (hash ^ p[j]) * prime;
+    }
+    p = (const unsigned char*)&m_dtc_params[0];
+    for (size_t j = 0; j < m_dtc_params.size() * sizeof(double); j++) {
+        hash = (hash ^ p[j]) * prime;
+    }
+    p = (const unsigned char*)&m_dtc_energy;
+    for (size_t j = 0; j < sizeof(double); j++) {
+        hash = (hash ^ p[j]) * prime;
+    }
+    m_hash = hash;
+}
@@ -28,6 +28,8 @@ bool SyncCtrlObj::checkTrigMode(TrigMode trig_mode) {
 	switch (trig_mode) {
 	case IntTrig:
 	case IntTrigMult:
+	case ExtTrigSingle:
+	case ExtTrigMult:
 	case ExtGate:
 		valid = true;
 		break;
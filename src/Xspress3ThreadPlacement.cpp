@@ -0,0 +1,237 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sstream>
+#include "lima/Exceptions.h"
+#include "Xspress3ThreadPlacement.h"
+
+using namespace lima;
+using namespace lima::Xspress3;
+using namespace std;
+
+static const char* RoleNames[] = { "hist", "scope", "acq", "read", "writer" };
+
+ThreadPlacement::ThreadPlacement() {
+    DEB_CONSTRUCTOR();
+    for (int role = 0; role < NbRoles; role++) {
+        CPU_ZERO(&m_roles[role].cpu_set);
+        m_roles[role].priority = 0;
+        m_generation[role] = 0;
+    }
+}
+
+/**
+ * Set the placement of a role, applied by its threads the next time they wake up.
+ *
+ * @param[in] role the thread role
+ * @param[in] cpus the cpu list, as for taskset -c, empty for no affinity
+ * @param[in] priority the SCHED_FIFO priority, 0 for SCHED_OTHER
+ */
+void ThreadPlacement::set(Role role, const string& cpus, int priority) {
+    DEB_MEMBER_FUNCT();
+    DEB_PARAM() << DEB_VAR3(getRoleName(role), cpus, priority);
+    cpu_set_t cpu_set;
+    parseCpus(cpus, cpu_set);
+    if (priority < 0 || priority > sched_get_priority_max(SCHED_FIFO)) {
+        THROW_HW_ERROR(InvalidValue) << "Invalid SCHED_FIFO priority " << priority;
+    }
+    AutoMutex aLock(m_mutex);
+    m_roles[role].cpus = cpus;
+    m_roles[role].cpu_set = cpu_set;
+    m_roles[role].priority = priority;
+    m_generation[role]++;
+}
+
+void ThreadPlacement::get(Role role, string& cpus, int& priority) {
+    AutoMutex aLock(m_mutex);
+    cpus = m_roles[role].cpus;
+    priority = m_roles[role].priority;
+}
+
+/**
+ * Get the cpu set of a role.
+ *
+ * @return false if the role has no cpu set
+ */
+bool ThreadPlacement::getCpuSet(Role role, cpu_set_t& cpu_set) {
+    AutoMutex aLock(m_mutex);
+    cpu_set = m_roles[role].cpu_set;
+    return !m_roles[role].cpus.empty();
+}
+
+/**
+ * Set the placement of several roles.
+ *
+ * @param[in] policy semicolon separated role=cpus[:priority], e.g. "hist=0-7;read=8-11:50"
+ */
+void ThreadPlacement::setPolicy(const string& policy) {
+    DEB_MEMBER_FUNCT();
+    DEB_PARAM() << DEB_VAR1(policy);
+    istringstream is(policy);
+    string item;
+    while (getline(is, item, ';')) {
+        if (item.empty())
+            continue;
+        size_t eq = item.find('=');
+        if (eq == string::npos) {
+            THROW_HW_ERROR(InvalidValue) << "Invalid thread placement " << item << ", expected role=cpus[:priority]";
+        }
+        string cpus = item.substr(eq + 1);
+        int priority = 0;
+        size_t colon = cpus.find(':');
+        if (colon != string::npos) {
+            priority = atoi(cpus.substr(colon + 1).c_str());
+            cpus = cpus.substr(0, colon);
+        }
+        set(getRole(item.substr(0, eq)), cpus, priority);
+    }
+}
+
+/**
+ * Apply the placement of a role to the calling thread if it changed since the last call, then
+ * record the placement read back from the system. A placement the system refuses (e.g. SCHED_FIFO
+ * without CAP_SYS_NICE) is reported as a warning and shows in the recorded placement.
+ *
+ * @param[in] role the role of the calling thread
+ * @param[in,out] generation the placement last applied by the calling thread, initially -1
+ */
+void ThreadPlacement::update(Role role, int& generation) {
+    DEB_MEMBER_FUNCT();
+    if (generation == m_generation[role])
+        return;
+    AutoMutex aLock(m_mutex);
+    Entry entry = m_roles[role];
+    generation = m_generation[role];
+    aLock.unlock();
+
+    pthread_t self = pthread_self();
+    ostringstream errors;
+    int err;
+    if (!entry.cpus.empty() && (err = pthread_setaffinity_np(self, sizeof(cpu_set_t), &entry.cpu_set)) != 0) {
+        errors << ", cpus " << entry.cpus << " refused: " << strerror(err);
+    }
+    int policy;
+    struct sched_param param;
+    pthread_getschedparam(self, &policy, &param);
+    if (entry.priority > 0 || policy == SCHED_FIFO) {
+        param.sched_priority = entry.priority;
+        if ((err = pthread_setschedparam(self, entry.priority > 0 ? SCHED_FIFO : SCHED_OTHER, &param)) != 0) {
+            errors << ", SCHED_FIFO " << entry.priority << " refused: " << strerror(err);
+        }
+    }
+
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    pthread_getaffinity_np(self, sizeof(cpu_set_t), &cpu_set);
+    pthread_getschedparam(self, &policy, &param);
+    ostringstream applied;
+    applied << "cpus " << formatCpus(cpu_set);
+    if (policy == SCHED_FIFO) {
+        applied << ", SCHED_FIFO " << param.sched_priority;
+    } else {
+        applied << ", SCHED_OTHER";
+    }
+    applied << errors.str();
+    if (!errors.str().empty()) {
+        DEB_WARNING() << getRoleName(role) << " thread placement: " << applied.str();
+    }
+    setApplied(role, applied.str());
+}
+
+void ThreadPlacement::setApplied(Role role, const string& applied) {
+    AutoMutex aLock(m_mutex);
+    m_roles[role].applied = applied;
+}
+
+/**
+ * Get the placement last applied to a thread of a role, empty if none of its threads has started.
+ */
+void ThreadPlacement::getApplied(Role role, string& applied) {
+    AutoMutex aLock(m_mutex);
+    applied = m_roles[role].applied;
+}
+
+ThreadPlacement::Role ThreadPlacement::getRole(const string& name) {
+    DEB_STATIC_FUNCT();
+    for (int role = 0; role < NbRoles; role++) {
+        if (name == RoleNames[role])
+            return (Role)role;
+    }
+    THROW_HW_ERROR(InvalidValue) << "Invalid thread role " << name << ", expected hist, scope, acq, read or writer";
+}
+
+const char* ThreadPlacement::getRoleName(Role role) {
+    return RoleNames[role];
+}
+
+/**
+ * Parse a cpu list such as "0-3,8,10-11".
+ */
+void ThreadPlacement::parseCpus(const string& cpus, cpu_set_t& cpu_set) {
+    DEB_STATIC_FUNCT();
+    CPU_ZERO(&cpu_set);
+    istringstream is(cpus);
+    string item;
+    while (getline(is, item, ',')) {
+        if (item.empty())
+            continue;
+        char* end;
+        long first = strtol(item.c_str(), &end, 10);
+        long last = first;
+        if (*end == '-') {
+            last = strtol(end + 1, &end, 10);
+        }
+        if (*end != '\0' || end == item.c_str() || first < 0 || last < first || last >= CPU_SETSIZE) {
+            THROW_HW_ERROR(InvalidValue) << "Invalid cpu list " << cpus;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            CPU_SET(cpu, &cpu_set);
+        }
+    }
+}
+
+/**
+ * Format a cpu set as a cpu list such as "0-3,8,10-11".
+ */
+string ThreadPlacement::formatCpus(const cpu_set_t& cpu_set) {
+    ostringstream os;
+    int cpu = 0;
+    while (cpu < CPU_SETSIZE) {
+        if (!CPU_ISSET(cpu, &cpu_set)) {
+            cpu++;
+            continue;
+        }
+        int last = cpu;
+        while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, &cpu_set)) {
+            last++;
+        }
+        if (os.tellp() > 0)
+            os << ",";
+        os << cpu;
+        if (last > cpu)
+            os << "-" << last;
+        cpu = last + 1;
+    }
+    return os.str();
+}
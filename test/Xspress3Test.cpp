@@ -96,7 +96,6 @@ int main(int argc, char *argv[])
 
 		m_control->acquisition()->setAcqNbFrames(nframes);
 		m_control->acquisition()->setAcqExpoTime(m_exp_time);
-		m_camera->setTiming(0, 0, 0, 100);
 		m_control->prepareAcq();
 		m_control->startAcq();
 
@@ -120,7 +119,6 @@ int main(int argc, char *argv[])
 		saving->setNextNumber(++num);
 		m_control->acquisition()->setAcqNbFrames(nframes);
 		m_control->acquisition()->setAcqExpoTime(m_exp_time);
-		m_camera->setTiming(0, 0, 0, 100);
 		m_control->prepareAcq();
 		m_control->startAcq();
 
@@ -136,6 +134,33 @@ int main(int argc, char *argv[])
 
 		DEB_TRACE() << "Finished collection 2";
 
+		// circular buffer: an unbounded IntTrig acquisition is rejected, a bounded one wraps round the histogram memory
+		m_camera->setRunMode(true, false, true, true, true);
+		m_control->acquisition()->setAcqNbFrames(0);
+		m_control->acquisition()->setAcqExpoTime(0.001);
+		try {
+			m_control->prepareAcq();
+			DEB_ERROR() << "Unbounded IntTrig acquisition not rejected";
+		} catch (Exception& ex) {
+			DEB_TRACE() << "Unbounded IntTrig acquisition rejected: " << ex;
+		}
+		nframes = maxFrames * 2 + 100;
+		m_exp_time = 0.001;
+		m_control->acquisition()->setAcqNbFrames(nframes);
+		m_control->prepareAcq();
+		m_control->startAcq();
+		delay.tv_sec = 0;
+		delay.tv_nsec = 100000000;
+		while (m_camera->isAcqRunning()) {
+			nanosleep(&delay, &remain);
+		}
+		long long ext_frame_nb;
+		m_camera->getExtFrameNumber(ext_frame_nb);
+		if (ext_frame_nb != nframes - 1) {
+			DEB_ERROR() << "Circular buffer acquisition stopped at frame " << ext_frame_nb << " of " << nframes;
+		}
+		DEB_TRACE() << "Finished collection 3";
+
 	} catch (Exception& ex) {
 		DEB_ERROR() << "LIMA Exception: " << ex;
 	} catch (...) {
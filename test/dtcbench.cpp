@@ -0,0 +1,162 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+// Micro-benchmark of the dead time correction kernel against the per bin
+// loop previously used by Camera::readHistogram, then of the float32
+// correction of blocks of frames by the read pool against the read thread
+// alone (Camera::setReadThreads).
+//
+// usage: dtcbench [nb_chans] [nb_frames] [max_threads]
+//###########################################################################
+#include "Xspress3Dtc.h"
+#include "Xspress3ReadPool.h"
+#include "xspress3.h"
+#include <stdlib.h>
+#include <sys/time.h>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+using namespace lima::Xspress3;
+
+static const int npixels = 4096;
+static const int nscalers = XSP3_SW_NUM_SCALERS;
+
+static double now() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec * 1E-6;
+}
+
+// the loop used by Camera::readHistogram, one channel at a time
+static void refLoop(const u_int32_t* frame, int nb_chans, const double* factors, double* dst) {
+	for (int chan = 0; chan < nb_chans; chan++) {
+		const u_int32_t* fptr = frame + chan * (npixels + nscalers);
+		double* dptr = dst + chan * npixels;
+		for (int i = 0; i < npixels; i++) {
+			*dptr++ = (double) *fptr++ * factors[chan];
+		}
+	}
+}
+
+static void report(const char* name, double elapsed, int nb_frames, int nb_chans, double ref) {
+	double mbins = (double)nb_frames * nb_chans * npixels / elapsed * 1E-6;
+	cout << "  " << name << "\t" << elapsed / nb_frames * 1E6 << " us/frame\t" << mbins << " Mbins/s";
+	if (ref > 0.0)
+		cout << "\tx" << ref / elapsed;
+	cout << endl;
+}
+
+static const int blockFrames = 32;
+
+// float32 correction of one channel of a frame of the block, as done by the read pool tasks
+class CorrectTask : public ReadPool::Task {
+public:
+	CorrectTask(DtcKernel& kernel, const u_int32_t* frame, int nb_chans, const double* factors, float* out) :
+		m_kernel(kernel), m_frame(frame), m_nb_chans(nb_chans), m_factors(factors), m_out(out) {}
+	virtual void run(int frame, int chan) {
+		int stride = npixels + nscalers;
+		m_kernel.correctHistograms(m_frame + chan * stride, stride, 1, npixels, &m_factors[chan],
+				m_out + ((size_t)frame * m_nb_chans + chan) * npixels);
+	}
+private:
+	DtcKernel& m_kernel;
+	const u_int32_t* m_frame;
+	int m_nb_chans;
+	const double* m_factors;
+	float* m_out;
+};
+
+int main(int argc, char *argv[])
+{
+	int nb_chans = (argc > 1) ? atoi(argv[1]) : 8;
+	int nb_frames = (argc > 2) ? atoi(argv[2]) : 2000;
+	int max_threads = (argc > 3) ? atoi(argv[3]) : 8;
+	int stride = npixels + nscalers;
+
+	vector<u_int32_t> frame(nb_chans * stride);
+	vector<double> factors(nb_chans);
+	srand(1);
+	for (size_t i = 0; i < frame.size(); i++)
+		frame[i] = (i % 7 == 0) ? 0xFFFFFFF0u - rand() % 16 : rand() % 100000;
+	for (int chan = 0; chan < nb_chans; chan++)
+		factors[chan] = 1.0 + 0.013 * (chan + 1);
+
+	vector<double> ref(nb_chans * npixels), dout(nb_chans * npixels);
+	vector<float> fout(nb_chans * npixels);
+
+	cout << "dtcbench " << nb_chans << " channels x " << npixels << " bins, " << nb_frames << " frames" << endl;
+	double start = now();
+	for (int n = 0; n < nb_frames; n++)
+		refLoop(&frame[0], nb_chans, &factors[0], &ref[0]);
+	double ref_time = now() - start;
+	report("loop", ref_time, nb_frames, nb_chans, 0.0);
+
+	int errors = 0;
+	DtcKernel kernel;
+	for (int isa = DtcKernel::Scalar; isa <= DtcKernel::getBestIsa(); isa++) {
+		kernel.setIsa((DtcKernel::Isa)isa);
+		const char* name = DtcKernel::getIsaName(kernel.getIsa());
+
+		start = now();
+		for (int n = 0; n < nb_frames; n++)
+			kernel.correctHistograms(&frame[0], stride, nb_chans, npixels, &factors[0], &dout[0]);
+		report(name, now() - start, nb_frames, nb_chans, ref_time);
+
+		start = now();
+		for (int n = 0; n < nb_frames; n++)
+			kernel.correctHistograms(&frame[0], stride, nb_chans, npixels, &factors[0], &fout[0]);
+		cout << "  " << name << " float32";
+		report("", now() - start, nb_frames, nb_chans, ref_time);
+
+		for (size_t i = 0; i < ref.size(); i++) {
+			if (dout[i] != ref[i] || fout[i] != (float)ref[i]) {
+				cout << "  " << name << " mismatch at " << i << " " << dout[i] << " " << fout[i] << " != " << ref[i] << endl;
+				errors++;
+				break;
+			}
+		}
+	}
+
+	// blocks of frames: read thread alone, then the read pool
+	kernel.setIsa(DtcKernel::getBestIsa());
+	int nb_blocks = (nb_frames + blockFrames - 1) / blockFrames;
+	vector<float> block(blockFrames * nb_chans * npixels);
+	cout << "blocks of " << blockFrames << " frames" << endl;
+	start = now();
+	for (int b = 0; b < nb_blocks; b++)
+		for (int n = 0; n < blockFrames; n++)
+			kernel.correctHistograms(&frame[0], stride, nb_chans, npixels, &factors[0], &block[n * nb_chans * npixels]);
+	double serial_time = now() - start;
+	report("read thread", serial_time, nb_blocks * blockFrames, nb_chans, 0.0);
+
+	CorrectTask task(kernel, &frame[0], nb_chans, &factors[0], &block[0]);
+	for (int nb_threads = 1; nb_threads <= max_threads; nb_threads *= 2) {
+		ReadPool pool;
+		pool.setNbThreads(nb_threads);
+		start = now();
+		for (int b = 0; b < nb_blocks; b++)
+			pool.run(task, blockFrames, nb_chans);
+		cout << "  pool " << nb_threads;
+		report("", now() - start, nb_blocks * blockFrames, nb_chans, serial_time);
+	}
+	return errors ? 1 : 0;
+}